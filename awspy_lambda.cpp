@@ -5,7 +5,9 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <libgen.h>
+#include <fcntl.h>
 #include <string.h>
+#include <string>
 #include <Python.h>
 
 extern "C" {
@@ -15,6 +17,7 @@ extern "C" {
 
 #include <3rdparty/json.h>
 #include <src/constants.h>
+#include <src/invocation_envelope.h>
 
 #define NAMESPACE 
 
@@ -35,6 +38,8 @@ struct InvocationArguments {
 	const char *function_name;
 	const char *payload_str;
 	const char *result_woof;
+	uint64_t correlation_id; // tags the result so that it gets back to the invocation
+	bool warmup; // only load the handler, the result is null
 };
 
 
@@ -45,6 +50,16 @@ struct FunctionMetadata {
 	                          // null if not defined, then the following values get defaults
 	const char *python_package_name; // the name of the python package
 	const char *python_function_name; // the name of the function in the python package
+	const char *code_sha256; // identifies the version of the code, null if not provided
+};
+
+// CSPOT runs the handler in a new process for every element put to the call woof, so the
+// interpreter, the helpers and the handler only live for a single invocation
+struct PythonState {
+	wchar_t *program_name = NULL;
+	PyObject *main_module = NULL;
+	PyObject *parse_payload = NULL;
+	PyObject *package_result = NULL;
 };
 
 
@@ -103,6 +118,9 @@ struct FunctionMetadata* load_function_metadata(const char *ns, json_value *func
 	metadata->function_directory = (char *)malloc(PATH_MAX);
 	sprintf((char *)metadata->function_directory, "%s/", ns);
 	metadata->function_name = strdup(json_get_str_for_key(func_metadata, "FunctionName"));
+	metadata->code_sha256 = json_get_str_for_key(func_metadata, "CodeSha256");
+	if (metadata->code_sha256)
+		metadata->code_sha256 = strdup(metadata->code_sha256);
 	metadata->handler_name = json_get_str_for_key(func_metadata, "Handler");
 	if (metadata->handler_name) {
 		metadata->handler_name = strdup(metadata->handler_name);
@@ -131,9 +149,33 @@ void free_function_metadata(struct FunctionMetadata *metadata) {
 		free((void *)metadata->handler_name);
 	free((void *)metadata->python_package_name);
 	free((void *)metadata->python_function_name);
+	if (metadata->code_sha256 != NULL)
+		free((void *)metadata->code_sha256);
 	free((void *)metadata);
 }
 
+// reads the metadata of the function from the installation directory, returns NULL unless it
+// is for the version of the code the invocation was made for
+struct FunctionMetadata* get_function_metadata(const char *ns, const char *code_sha256) {
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", ns, INVOCATION_METADATA_FILE);
+	fdebugf(stdout, "loading the function metadata from %s\n", path);
+	json_value *json = read_json_file(path);
+	struct FunctionMetadata *metadata = load_function_metadata(ns, json);
+	if (json != NULL)
+		json_value_free(json);
+	if (metadata == NULL)
+		return NULL;
+
+	if (metadata->code_sha256 == NULL || strcmp(metadata->code_sha256, code_sha256) != 0) {
+		fdebugf(stderr, "Fatal error: the installation holds code %s but the invocation is for %s\n",
+			metadata->code_sha256 ? metadata->code_sha256 : "<none>", code_sha256);
+		free_function_metadata(metadata);
+		return NULL;
+	}
+	return metadata;
+}
+
 int create_python_helpers() {
 	// see: https://stackoverflow.com/questions/3286448/calling-a-python-method-from-c-c-and-extracting-its-return-value 
 	// for the work around used to avoid creating a temporary file
@@ -179,22 +221,22 @@ const char *decode_python_string(PyObject *pystr) {
 	return result;
 }
 
-int invoke_function(struct FunctionMetadata *function_metadata, struct InvocationArguments *arguments) {
+// starts the interpreter and loads the helpers
+int init_python(PythonState *state) {
 	// update the PYTHONPATH to include the current working directory
 	{
 		const char *pypath = getenv("PYTHONPATH");
-		char newpypath[1024];
-		sprintf(newpypath, "PYTHONPATH=%s:.", pypath);
-		putenv(newpypath);
+		std::string newpypath = pypath ? std::string(pypath) + ":." : std::string(".");
+		setenv("PYTHONPATH", newpypath.c_str(), 1);
 	}
 	fdebugf(stdout, "updated python path to include the current directory\n");
 
-	wchar_t *program_name = Py_DecodeLocale("main.py", NULL);
-	Py_SetProgramName(program_name);
+	state->program_name = Py_DecodeLocale("main.py", NULL);
+	Py_SetProgramName(state->program_name);
 	Py_Initialize();
 
-	PyObject *main_module = PyImport_Import(PyUnicode_DecodeFSDefault("__main__"));
-	if (!main_module) {
+	state->main_module = PyImport_Import(PyUnicode_DecodeFSDefault("__main__"));
+	if (!state->main_module) {
 		fdebugf(stderr, "Fatal error: failed to get a handle on the main module __main__\n");
 		PyErr_Print();
 		fflush(stderr);
@@ -203,12 +245,28 @@ int invoke_function(struct FunctionMetadata *function_metadata, struct Invocatio
 
 	fdebugf(stdout, "initializing helper functions\n");
 	create_python_helpers();
-	PyObject *pyfunc_parse_payload = get_python_method(main_module, "__pylambda_parse_payload");
-	PyObject *pyfunc_package_result = get_python_method(main_module, "__pylambda_package_result");
-	if (!pyfunc_parse_payload || !pyfunc_package_result) {
+	state->parse_payload = get_python_method(state->main_module, "__pylambda_parse_payload");
+	state->package_result = get_python_method(state->main_module, "__pylambda_package_result");
+	if (!state->parse_payload || !state->package_result) {
 		fdebugf(stderr, "Failed to get one of the helper functions, aborting\n");
 		return -1;
 	}
+	return 0;
+}
+
+void finalize_python(PythonState *state) {
+	Py_XDECREF(state->main_module);
+	Py_XDECREF(state->parse_payload);
+	Py_XDECREF(state->package_result);
+	if (Py_FinalizeEx() < 0) {
+		fdebugf(stderr, "failed to finalize the python interpreter\n");
+	}
+	PyMem_RawFree(state->program_name);
+}
+
+int call_function(PythonState *state, struct FunctionMetadata *function_metadata, struct InvocationArguments *arguments) {
+	PyObject *pyfunc_parse_payload = state->parse_payload;
+	PyObject *pyfunc_package_result = state->package_result;
 
 	fdebugf(stdout, "getting a handle on the handler: %s.%s\n", 
 		function_metadata->python_package_name, 
@@ -227,6 +285,7 @@ int invoke_function(struct FunctionMetadata *function_metadata, struct Invocatio
 		fdebugf(stderr, 
 			"Fatal error: the function '%s' could not be found in package '%s'\n", 
 			function_metadata->python_function_name, function_metadata->python_package_name);
+		Py_DECREF(lambda_module);
 		return -1;
 	}
 
@@ -248,9 +307,16 @@ int invoke_function(struct FunctionMetadata *function_metadata, struct Invocatio
 	fdebugf(stdout, "\n");
 
 	// Invoking the lambda function
-	fdebugf(stdout, "invoking the lambda\n");
-	args = py_payload;
-	PyObject *py_lambda_result = PyObject_CallObject(lambda_function, args);
+	PyObject *py_lambda_result;
+	if (arguments->warmup) {
+		fdebugf(stdout, "warm up invocation, the handler is loaded but not called\n");
+		Py_INCREF(Py_None);
+		py_lambda_result = Py_None;
+	} else {
+		fdebugf(stdout, "invoking the lambda\n");
+		args = py_payload;
+		py_lambda_result = PyObject_CallObject(lambda_function, args);
+	}
 
 	if (PyErr_Occurred()) {
 		fprintf(stdout, "Detected that an error occured. Fetching and printing that error\n");
@@ -292,16 +358,43 @@ int invoke_function(struct FunctionMetadata *function_metadata, struct Invocatio
 		}
 
 		const char *result_str = decode_python_string(py_packaged_result);
+		Py_DECREF(py_packaged_result);
+		size_t result_len = strlen(result_str);
 
-		if (strlen(result_str) > RESULT_WOOF_EL_SIZE) {
-			fdebugf(stderr, "Fatal error: result object can not fit in ELEMENT_SIZE (%d bytes)\n", RESULT_WOOF_EL_SIZE);
+		// the caller is waiting for a result, it gets an error rather than nothing
+		if (result_len > INVOCATION_MAX_RESULT_SIZE) {
+			fdebugf(stderr, "Fatal error: result object is larger than %d bytes\n", INVOCATION_MAX_RESULT_SIZE);
 			free((void *)result_str);
-			return -1;
+			result_str = strdup("{\"errorType\": \"Function.ResponseSizeTooLarge\", "
+				"\"errorMessage\": \"Response payload size exceeded maximum allowed payload size\"}");
+			result_len = strlen(result_str);
 		}
 
+		// header followed by the result, or by the name of the file it was spilled to
 		char result_element_buffer[RESULT_WOOF_EL_SIZE];
 		memset(result_element_buffer, 0, RESULT_WOOF_EL_SIZE);
-		strcpy(result_element_buffer, result_str);
+		struct InvocationResultHeader header;
+		header.correlation_id = arguments->correlation_id;
+		header.flags = 0;
+		header.blob_length = 0;
+		char *value = result_element_buffer + sizeof(header);
+
+		if (sizeof(header) + result_len + 1 > RESULT_WOOF_EL_SIZE) {
+			snprintf(value, RESULT_WOOF_EL_SIZE - sizeof(header), INVOCATION_BLOB_DIR "/%016llx.result", 
+				(unsigned long long)arguments->correlation_id);
+			if (invocation_blob_write(value, result_str, result_len) != 0) {
+				fdebugf(stderr, "Fatal error: failed to spill the result to %s\n", value);
+				unlink(value);
+				strcpy(value, "{\"errorMessage\": \"failed to store the result\"}");
+			} else {
+				header.flags = INVOCATION_RESULT_BLOB;
+				header.blob_length = result_len;
+			}
+		} else {
+			memcpy(value, result_str, result_len);
+		}
+		memcpy(result_element_buffer, &header, sizeof(header));
+		free((void *)result_str);
 
 		int idx = WooFPut((char *)arguments->result_woof, NULL, result_element_buffer);
 		if (idx < 0) {
@@ -309,27 +402,40 @@ int invoke_function(struct FunctionMetadata *function_metadata, struct Invocatio
 			return -1;
 		}
 		fdebugf(stdout, "Result successfully placed in result woof: '%s'\n", arguments->result_woof);
+
+		// wake up whoever is waiting for the result, if nobody has the fifo open the open fails
+		// and the waiter will find the result when it checks
+		char notifypath[PATH_MAX];
+		snprintf(notifypath, sizeof(notifypath), "%s" RESULT_WOOF_NOTIFY_SUFFIX, arguments->result_woof);
+		int notifyfd = open(notifypath, O_WRONLY | O_NONBLOCK);
+		if (notifyfd >= 0) {
+			char wakeup = 1;
+			if (write(notifyfd, &wakeup, 1) != 1)
+				fdebugf(stderr, "failed to signal %s\n", notifypath);
+			close(notifyfd);
+		}
 	} else {
 		fdebugf(stdout, "No result woof specified. Nothing to do with the result, discarding it\n");
 	}
 
 	// free our memory
-	Py_DECREF(py_lambda_result);
+	Py_XDECREF(py_lambda_result);
 	Py_DECREF(py_payload);
-	Py_DECREF(main_module);
-	Py_DECREF(lambda_module);
 	Py_DECREF(lambda_function);
-	Py_DECREF(pyfunc_parse_payload);
-	Py_DECREF(pyfunc_package_result);
-
-	if (Py_FinalizeEx() < 0) {
-		return 120;
-	}
-	PyMem_RawFree(program_name);
+	Py_DECREF(lambda_module);
 
 	return 0;
 }
 
+int invoke_function(struct FunctionMetadata *function_metadata, struct InvocationArguments *arguments) {
+	PythonState state;
+	int retval = init_python(&state);
+	if (retval == 0)
+		retval = call_function(&state, function_metadata, arguments);
+	finalize_python(&state);
+	return retval;
+}
+
 int awspy_lambda(WOOF *wf, unsigned long seq_no, void *ptr) {
 	struct InvocationArguments arguments;
 	struct FunctionMetadata *function_metadata;
@@ -343,45 +449,51 @@ int awspy_lambda(WOOF *wf, unsigned long seq_no, void *ptr) {
 	fdebugf(stdout, "awspy_lambda invocation starting:\n");
 	fdebugf(stdout, "namespace directory: %s\n", ns);
 
-	// STEP 2) decode the function name & json data sections
-	fdebugf(stdout, "metadata: %s\n", input_data_buffer);
-	json_value *json_data = json_parse(input_data_buffer, strlen(input_data_buffer));
-
-	if (!json_data) {
-		fdebugf(stderr, "Fatal error: failed to decode the JSON payload\n");
+	// STEP 2) decode the envelope in front of the payload
+	const struct InvocationEnvelope *envelope = (const struct InvocationEnvelope *)input_data_buffer;
+	if (envelope->magic != INVOCATION_ENVELOPE_MAGIC || envelope->version != INVOCATION_ENVELOPE_VERSION ||
+		envelope->payload_offset < sizeof(struct InvocationEnvelope) ||
+		(size_t)envelope->payload_offset + envelope->payload_length >= CALL_WOOF_EL_SIZE ||
+		input_data_buffer[envelope->payload_offset + envelope->payload_length] != '\0' ||
+		memchr(envelope->function_name, '\0', sizeof(envelope->function_name)) == NULL ||
+		memchr(envelope->code_sha256, '\0', sizeof(envelope->code_sha256)) == NULL) {
+		fdebugf(stderr, "Fatal error: the invocation envelope is malformed\n");
 		return -1;
 	}
 
-	// read a few keys from the json data and initialize the arguments struct 
-	arguments.function_name = json_get_str_for_key(json_data, "function");
-	arguments.result_woof = json_get_str_for_key(json_data, "result_woof");
-	arguments.payload_str = input_data_buffer + strlen(input_data_buffer) + 1;
-	fdebugf(stdout, "the payload is: %s\n", arguments.payload_str);
-
-	if (!arguments.function_name || !arguments.payload_str) {
-		fdebugf(stderr, "Fatal error: invocation json_data is missing a required property 'function_name' or 'payload_str'\n");
-		return -1;
+	arguments.function_name = envelope->function_name;
+	arguments.payload_str = input_data_buffer + envelope->payload_offset;
+	arguments.warmup = (envelope->flags & INVOCATION_FLAG_WARMUP) != 0;
+	if (envelope->flags & INVOCATION_FLAG_REQUEST_RESPONSE) {
+		arguments.result_woof = RESULT_WOOF_NAME;
+		arguments.correlation_id = envelope->correlation_id;
+	} else {
+		arguments.result_woof = NULL;
+		arguments.correlation_id = 0;
 	}
+	fdebugf(stdout, "the payload is: %s\n", arguments.payload_str);
 
 	fdebugf(stdout,
 		"arguments:\n"
 		"\tfunction name: %s\n"
 		"\tresult woof: %s\n"
-		"\tpayload.length: %d\n",
+		"\tpayload.length: %u\n",
 		arguments.function_name,
 		arguments.result_woof ? arguments.result_woof : "<none>",
-		strlen(arguments.payload_str)
+		envelope->payload_length
 		);
 
-
 	// load the function's metadata
-	json_value *function_metadata_json = json_object_value_of_key(json_data, "metadata");
-	if ((function_metadata = load_function_metadata(ns, function_metadata_json)) == NULL) {
+	if ((function_metadata = get_function_metadata(ns, envelope->code_sha256)) == NULL) {
 		fdebugf(stderr, "Fatal error encountered while loading metadata, aborting");
 		return -1;
 	}
 	
-	assert(function_metadata->function_name == arguments.function_name);
+	if (strcmp(function_metadata->function_name, arguments.function_name) != 0) {
+		fdebugf(stderr, "Fatal error: the invocation is for '%s' but the installation is for '%s'\n",
+			arguments.function_name, function_metadata->function_name);
+		return -1;
+	}
 	fdebugf(stdout, 
 		"metadata:\n"
 		"\tfunction name: %s\n"
@@ -402,8 +514,25 @@ int awspy_lambda(WOOF *wf, unsigned long seq_no, void *ptr) {
 		return -1;
 	}
 
-	invoke_function(function_metadata, &arguments);
+	// a payload that did not fit was spilled to a file, the element holds its name
+	char *payload_blob = NULL;
+	if (envelope->flags & INVOCATION_FLAG_PAYLOAD_BLOB) {
+		const char *blob_name = arguments.payload_str;
+		if (strncmp(blob_name, INVOCATION_BLOB_DIR "/", strlen(INVOCATION_BLOB_DIR) + 1) != 0 || strstr(blob_name, "..") != NULL) {
+			fdebugf(stderr, "Fatal error: the payload blob '%s' is not in the blob directory\n", blob_name);
+			return -1;
+		}
+		payload_blob = envelope->blob_length <= INVOCATION_MAX_PAYLOAD_SIZE ? invocation_blob_read(blob_name, envelope->blob_length) : NULL;
+		unlink(blob_name);
+		if (payload_blob == NULL) {
+			fdebugf(stderr, "Fatal error: failed to read the payload from '%s'\n", blob_name);
+			return -1;
+		}
+		arguments.payload_str = payload_blob;
+	}
 
+	invoke_function(function_metadata, &arguments);
+	free(payload_blob);
 	free_function_metadata(function_metadata);
 	
 	fdebugf(stdout, "Done.\n");
@@ -0,0 +1,100 @@
+#ifndef HTTP_POOL_HPP
+#define HTTP_POOL_HPP
+
+#include <curl/curl.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <condition_variable>
+
+// a fixed number of libcurl easy handles that are reused across requests. libcurl keeps the
+// connection of an easy handle open after a request (HTTP/1.1 keep-alive), so reusing handles
+// means requests to the same endpoint skip the tcp handshake and do not leave a socket in
+// TIME_WAIT behind each time. At most maxConnections requests are in flight at once, callers
+// beyond that wait for a handle to be returned.
+class HttpConnectionPool {
+	std::mutex lock;
+	std::condition_variable available;
+	std::vector<CURL *> idle;
+	size_t created = 0;
+	size_t maxConnections;
+
+	static size_t writeCallback(char *data, size_t size, size_t nmemb, void *userdata) {
+		((std::string *)userdata)->append(data, size * nmemb);
+		return size * nmemb;
+	}
+
+	CURL *acquire() {
+		std::unique_lock<std::mutex> g(this->lock);
+		this->available.wait(g, [this] { return !this->idle.empty() || this->created < this->maxConnections; });
+		if (!this->idle.empty()) {
+			CURL *handle = this->idle.back();
+			this->idle.pop_back();
+			return handle;
+		}
+		CURL *handle = curl_easy_init();
+		if (handle != NULL)
+			this->created++;
+		return handle;
+	}
+
+	void release(CURL *handle) {
+		{
+			std::lock_guard<std::mutex> g(this->lock);
+			this->idle.push_back(handle);
+		}
+		this->available.notify_one();
+	}
+
+public:
+	HttpConnectionPool(size_t maxConnections) : maxConnections(maxConnections) {
+		static std::once_flag curlInitialized;
+		std::call_once(curlInitialized, [] { curl_global_init(CURL_GLOBAL_ALL); });
+	}
+
+	~HttpConnectionPool() {
+		for (CURL *handle : this->idle) {
+			curl_easy_cleanup(handle);
+		}
+	}
+
+	// posts body to url, returns the http status of the response or -1 if the request could
+	// not be made at all. headers are "Name: value" strings.
+	long post(const std::string& url, const std::vector<std::string>& headers,
+		const std::string& body, std::string& response, long timeoutSeconds) {
+		CURL *handle = this->acquire();
+		if (handle == NULL)
+			return -1;
+
+		struct curl_slist *headerList = NULL;
+		for (const auto& header : headers) {
+			headerList = curl_slist_append(headerList, header.c_str());
+		}
+
+		// options are sticky on a reused handle, reset them but keep the connection cache
+		curl_easy_reset(handle);
+		curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+		curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headerList);
+		curl_easy_setopt(handle, CURLOPT_POSTFIELDS, body.c_str());
+		curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE, (long)body.length());
+		curl_easy_setopt(handle, CURLOPT_TIMEOUT, timeoutSeconds);
+		curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+		curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+		curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &HttpConnectionPool::writeCallback);
+		curl_easy_setopt(handle, CURLOPT_WRITEDATA, &response);
+
+		long status = -1;
+		CURLcode result = curl_easy_perform(handle);
+		if (result == CURLE_OK) {
+			curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+		} else {
+			fprintf(stderr, "HTTP request to %s failed: %s\n", url.c_str(), curl_easy_strerror(result));
+		}
+
+		curl_slist_free_all(headerList);
+		this->release(handle);
+		return status;
+	}
+};
+
+#endif
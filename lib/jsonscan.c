@@ -0,0 +1,207 @@
+#include <string.h>
+#include "jsonscan.h"
+
+/*
+	Validating JSON scanner
+*/
+
+struct jsonscan {
+	const unsigned char *pos;
+	const unsigned char *end;
+};
+
+static void skip_whitespace(struct jsonscan *s) {
+	while (s->pos < s->end && (*s->pos == ' ' || *s->pos == '\t' || *s->pos == '\n' || *s->pos == '\r'))
+		s->pos++;
+}
+
+static int is_hex(unsigned char c) {
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static int scan_digits(struct jsonscan *s) {
+	const unsigned char *start = s->pos;
+	while (s->pos < s->end && *s->pos >= '0' && *s->pos <= '9')
+		s->pos++;
+	return s->pos == start ? -1 : 0;
+}
+
+// one utf-8 encoded character that starts with a byte >= 0x80, rejects overlong encodings,
+// surrogates and anything past U+10FFFF
+static int scan_utf8(struct jsonscan *s) {
+	unsigned char c = *s->pos++;
+	unsigned char low = 0x80, high = 0xBF;
+	int continuations;
+
+	if (c >= 0xC2 && c <= 0xDF) {
+		continuations = 1;
+	} else if (c >= 0xE0 && c <= 0xEF) {
+		continuations = 2;
+		if (c == 0xE0) low = 0xA0;
+		if (c == 0xED) high = 0x9F;
+	} else if (c >= 0xF0 && c <= 0xF4) {
+		continuations = 3;
+		if (c == 0xF0) low = 0x90;
+		if (c == 0xF4) high = 0x8F;
+	} else {
+		return -1;
+	}
+
+	// the range restriction only applies to the first continuation byte
+	while (continuations-- > 0) {
+		if (s->pos == s->end || *s->pos < low || *s->pos > high)
+			return -1;
+		s->pos++;
+		low = 0x80;
+		high = 0xBF;
+	}
+	return 0;
+}
+
+static int scan_string(struct jsonscan *s) {
+	s->pos++; // the opening quote
+	while (s->pos < s->end) {
+		unsigned char c = *s->pos;
+		if (c == '"') {
+			s->pos++;
+			return 0;
+		} else if (c < 0x20) {
+			return -1; // control characters (including nul) must be escaped
+		} else if (c == '\\') {
+			if (++s->pos == s->end)
+				return -1;
+			switch (*s->pos++) {
+			case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+				break;
+			case 'u':
+				if (s->end - s->pos < 4 || !is_hex(s->pos[0]) || !is_hex(s->pos[1]) ||
+					!is_hex(s->pos[2]) || !is_hex(s->pos[3]))
+					return -1;
+				s->pos += 4;
+				break;
+			default:
+				return -1;
+			}
+		} else if (c >= 0x80) {
+			if (scan_utf8(s) != 0)
+				return -1;
+		} else {
+			s->pos++;
+		}
+	}
+	return -1;
+}
+
+// -? (0 | [1-9][0-9]*) (. [0-9]+)? ([eE] [+-]? [0-9]+)?
+static int scan_number(struct jsonscan *s) {
+	if (*s->pos == '-')
+		s->pos++;
+	if (s->pos == s->end)
+		return -1;
+	if (*s->pos == '0') {
+		s->pos++;
+	} else if (scan_digits(s) != 0) {
+		return -1;
+	}
+	if (s->pos < s->end && *s->pos == '.') {
+		s->pos++;
+		if (scan_digits(s) != 0)
+			return -1;
+	}
+	if (s->pos < s->end && (*s->pos == 'e' || *s->pos == 'E')) {
+		s->pos++;
+		if (s->pos < s->end && (*s->pos == '+' || *s->pos == '-'))
+			s->pos++;
+		if (scan_digits(s) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int scan_literal(struct jsonscan *s, const char *literal) {
+	size_t len = strlen(literal);
+	if ((size_t)(s->end - s->pos) < len || memcmp(s->pos, literal, len) != 0)
+		return -1;
+	s->pos += len;
+	return 0;
+}
+
+int jsonscan_validate(const char *buffer, size_t len) {
+	struct jsonscan s = { (const unsigned char *)buffer, (const unsigned char *)buffer + len };
+
+	// the closing character of each object or array we are in
+	char closers[JSONSCAN_MAX_DEPTH];
+	int depth = 0;
+
+	skip_whitespace(&s);
+	while (1) {
+		// a value is expected here
+		if (s.pos == s.end)
+			return -1;
+
+		int retval = 0;
+		switch (*s.pos) {
+		case '{':
+		case '[':
+			if (depth == JSONSCAN_MAX_DEPTH)
+				return -1;
+			closers[depth++] = *s.pos == '{' ? '}' : ']';
+			s.pos++;
+			skip_whitespace(&s);
+			if (s.pos < s.end && *s.pos == closers[depth - 1]) {
+				s.pos++;
+				depth--;
+				break; // empty
+			}
+			if (closers[depth - 1] == '}')
+				goto member;
+			continue;
+		case '"':
+			retval = scan_string(&s);
+			break;
+		case 't':
+			retval = scan_literal(&s, "true");
+			break;
+		case 'f':
+			retval = scan_literal(&s, "false");
+			break;
+		case 'n':
+			retval = scan_literal(&s, "null");
+			break;
+		default:
+			if (*s.pos != '-' && (*s.pos < '0' || *s.pos > '9'))
+				return -1;
+			retval = scan_number(&s);
+		}
+		if (retval != 0)
+			return -1;
+
+	after_value:
+		skip_whitespace(&s);
+		if (depth == 0)
+			return s.pos == s.end ? 0 : -1;
+		if (s.pos == s.end)
+			return -1;
+		if (*s.pos == closers[depth - 1]) {
+			s.pos++;
+			depth--;
+			goto after_value;
+		}
+		if (*s.pos != ',')
+			return -1;
+		s.pos++;
+		skip_whitespace(&s);
+		if (closers[depth - 1] == ']')
+			continue;
+
+	member:
+		// "key" : value
+		if (s.pos == s.end || *s.pos != '"' || scan_string(&s) != 0)
+			return -1;
+		skip_whitespace(&s);
+		if (s.pos == s.end || *s.pos != ':')
+			return -1;
+		s.pos++;
+		skip_whitespace(&s);
+	}
+}
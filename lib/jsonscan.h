@@ -0,0 +1,25 @@
+#ifndef JSONSCAN_H
+#define JSONSCAN_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+	Validating JSON scanner, checks a buffer without building a document so that a payload can be
+	passed along as is after it has been checked
+*/
+
+#define JSONSCAN_MAX_DEPTH 512
+
+// returns 0 if buffer holds exactly one JSON value (RFC 8259, utf-8) with optional whitespace
+// around it, -1 otherwise. A buffer that passes contains no nul bytes.
+extern int jsonscan_validate(const char *buffer, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef MD5_UTIL_H
+#define MD5_UTIL_H
+
+#include <openssl/md5.h>
+
+#define MD5_BASE16DIGEST_LENGTH (33)
+inline void md5(const char *data, unsigned long length, char outputBuffer[33])
+{
+	unsigned char hash[MD5_DIGEST_LENGTH];
+	MD5((const unsigned char *)data, length, hash);
+	int i = 0;
+	for(i = 0; i < MD5_DIGEST_LENGTH; i++)
+	{
+		sprintf(outputBuffer + (i * 2), "%02x", hash[i]);
+	}
+	outputBuffer[32] = 0;
+}
+
+#endif
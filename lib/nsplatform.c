@@ -0,0 +1,83 @@
+#define _GNU_SOURCE // pipe2
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "nsplatform.h"
+
+/*
+	The exec is reported back over a pipe that is closed on exec: the parent reads EOF once the
+	exec succeeded, or the child's errno if it failed.
+*/
+
+pid_t nsplatform_spawn(const char *dir, char *const argv[]) {
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) != 0)
+		return -1;
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	} else if (pid == 0) {
+		close(fds[0]);
+		if (chdir(dir) == 0)
+			execv(argv[0], argv);
+		int error = errno;
+		ssize_t ignored = write(fds[1], &error, sizeof(error));
+		(void)ignored;
+		_exit(127);
+	}
+
+	close(fds[1]);
+	int error = 0;
+	ssize_t n;
+	while ((n = read(fds[0], &error, sizeof(error))) < 0 && errno == EINTR)
+		;
+	close(fds[0]);
+
+	if (n != 0) {
+		fprintf(stderr, "failed to start %s in %s: errno %d\n", argv[0], dir, error);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+	return pid;
+}
+
+static long elapsed_ms(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000L + (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+int nsplatform_wait_ready(pid_t pid, int (*probe)(void *), void *ctx, long timeout_ms) {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	long backoff_ms = NSPLATFORM_PROBE_MIN_MS;
+	while (1) {
+		int retval = probe(ctx);
+		if (retval >= 0) {
+			fprintf(stdout, "namespace platform %d ready after %ldms\n", (int)pid, elapsed_ms(&start));
+			return retval;
+		}
+
+		if (waitpid(pid, NULL, WNOHANG) != 0) {
+			fprintf(stderr, "namespace platform %d exited before it was ready\n", (int)pid);
+			return -1;
+		}
+		if (elapsed_ms(&start) >= timeout_ms) {
+			fprintf(stderr, "namespace platform %d not ready after %ldms\n", (int)pid, timeout_ms);
+			return -2;
+		}
+
+		struct timespec delay = { 0, backoff_ms * 1000000L };
+		nanosleep(&delay, NULL);
+		backoff_ms *= 2;
+		if (backoff_ms > NSPLATFORM_PROBE_MAX_MS)
+			backoff_ms = NSPLATFORM_PROBE_MAX_MS;
+	}
+}
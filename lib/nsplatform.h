@@ -0,0 +1,42 @@
+#ifndef NSPLATFORM_H
+#define NSPLATFORM_H
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+	Starting a woofc-namespace-platform and waiting for it to serve its namespace, instead of
+	sleeping for a fixed time after the fork
+*/
+
+#define NSPLATFORM_READY_TIMEOUT_MS 10000L
+#define NSPLATFORM_PROBE_MIN_MS 1L // the first retry of the probe, doubled after every failure
+#define NSPLATFORM_PROBE_MAX_MS 50L
+// how long a round trip probe waits for its result before the next one is put
+#define NSPLATFORM_PROBE_ROUNDTRIP_MS 1000L
+
+// WooFInit only shows that the platform initialized the namespace, it launches handlers once it
+// serves it. A put to NSPLATFORM_PROBE_WOOF is echoed into NSPLATFORM_PROBE_RESULT_WOOF by the
+// NSPLATFORM_PROBE_HANDLER handler (nsprobe.c), for namespaces that have no handler of their own.
+#define NSPLATFORM_PROBE_WOOF "nsprobe.woof"
+#define NSPLATFORM_PROBE_RESULT_WOOF "nsprobe.result.woof"
+#define NSPLATFORM_PROBE_HANDLER "nsprobe"
+#define NSPLATFORM_PROBE_QUEUE_DEPTH 64
+
+// forks and execs argv[0] with the working directory dir, returns the pid once the exec has
+// succeeded or -1 if the fork, the chdir or the exec failed. Safe to call from a multithreaded
+// process, the child only makes async signal safe calls before the exec.
+extern pid_t nsplatform_spawn(const char *dir, char *const argv[]);
+
+// calls probe(ctx) until it returns >= 0 and returns that value, backing off between attempts.
+// Returns -1 if the platform exited in the meantime and -2 if timeout_ms passed.
+extern int nsplatform_wait_ready(pid_t pid, int (*probe)(void *), void *ctx, long timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
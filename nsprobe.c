@@ -0,0 +1,14 @@
+#include <stdio.h>
+
+#include "woofc.h"
+#include "lib/nsplatform.h"
+
+// the handler of the readiness probe (see lib/nsplatform.h), the element is echoed into the result
+// woof so that whoever put it knows the platform launched a handler
+int nsprobe(WOOF *wf, unsigned long seqno, void *ptr) {
+	if (WooFInvalid(WooFPut(NSPLATFORM_PROBE_RESULT_WOOF, NULL, ptr))) {
+		fprintf(stderr, "nsprobe: failed to put the result of probe %lu\n", seqno);
+		return -1;
+	}
+	return 0;
+}
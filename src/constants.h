@@ -5,6 +5,8 @@
 
 #define LAMBDA_API_ENDPOINT "http://cspot.lastpengu.in:8080"
 #define S3_API_ENDPOINT "http://cspot.lastpengu.in:8081"
+// the lambda_client also accepts invocations on this socket from bridges on the same host
+#define LAMBDA_LOCAL_TRIGGER_SOCKET "/tmp/cspot-lambda-trigger.sock"
 
 #define PARALLELISM_SUPPORT 8 
 
@@ -13,13 +15,38 @@
 #define WPTHREAD_COUNT PARALLELISM_SUPPORT
 #define WORKER_QUEUE_DEPTH (PARALLELISM_SUPPORT * 2)
 #define OBJECT_POOL_SIZE (PARALLELISM_SUPPORT * 2)
-#define RESULT_WOOF_COUNT PARALLELISM_SUPPORT
 
 #define CALL_WOOF_NAME "lambda.woof"
+#define CALL_WOOF_HANDLER "awspy_lambda"
 #define CALL_WOOF_EL_SIZE (16 * 1024)
 #define CALL_WOOF_QUEUE_DEPTH (PARALLELISM_SUPPORT * 2)
+// the results of every synchronous invocation of a function go to one result woof, tagged with 
+// the invocation's correlation id (see src/invocation_envelope.h)
+#define RESULT_WOOF_NAME "result.woof"
 #define RESULT_WOOF_EL_SIZE CALL_WOOF_EL_SIZE
+#define RESULT_WOOF_QUEUE_DEPTH (PARALLELISM_SUPPORT * 16)
+#define RESULT_ROUTER_WAIT_MS 1000L
+#define RESULT_TIMEOUT_MS 30000L
+// an installation that was replaced or removed is torn down after this long, so that 
+// invocations still running in it can finish
+#define INSTALLATION_RETIRE_DELAY_S (RESULT_TIMEOUT_MS / 1000)
+// how often a retired installation that invocations still hold is checked again
+#define INSTALLATION_REAP_RECHECK_S 1L
+// backoff between retries of a background install that failed, doubled after every failure
+#define INSTALL_RETRY_MIN_DELAY_S 1L
+#define INSTALL_RETRY_MAX_DELAY_S 300L
+// a fifo next to the result woof, the handler writes a byte to it after putting a result so 
+// that the waiter does not have to poll for it
+#define RESULT_WOOF_NOTIFY_SUFFIX ".notify"
 
 #define MAX_WOOF_EL_SIZE CALL_WOOF_EL_SIZE
 
+// OPTIONS FOR S3 EVENT NOTIFICATIONS
+
+#define NOTIFICATION_DISPATCH_THREADS PARALLELISM_SUPPORT
+// keep-alive connections to the lambda api, one per dispatcher thread
+#define NOTIFICATION_HTTP_CONNECTIONS NOTIFICATION_DISPATCH_THREADS
+// batches of events are cut short so that they fit in a single invocation
+#define NOTIFICATION_MAX_BATCH_BYTES (CALL_WOOF_EL_SIZE - 1024)
+
 #endif
@@ -0,0 +1,93 @@
+#ifndef __INVOCATION_ENVELOPE_H
+#define __INVOCATION_ENVELOPE_H
+
+/*
+	the layout of an element of the call woof (CALL_WOOF_NAME):
+
+		struct InvocationEnvelope | payload (json) \0
+
+	the envelope only identifies the function and the version of its code, the rest of the
+	function's metadata is written once to INVOCATION_METADATA_FILE in the installation directory
+	and the handler caches it by code sha256.
+
+	a payload that does not fit in the element is written to a file in INVOCATION_BLOB_DIR 
+	(relative to the installation directory) and the element holds the name of the file instead, 
+	with INVOCATION_FLAG_PAYLOAD_BLOB set. The handler removes the file once it has read it.
+
+	an element of the result woof (RESULT_WOOF_NAME) is
+
+		struct InvocationResultHeader | result (json) \0
+
+	where a result that does not fit is spilled the same way, with INVOCATION_RESULT_BLOB set.
+	Whoever reads the result removes the file.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define INVOCATION_ENVELOPE_MAGIC 0x4c564e45u
+#define INVOCATION_ENVELOPE_VERSION 1
+#define INVOCATION_FUNCTION_NAME_MAX 128
+
+// the handler puts the result in RESULT_WOOF_NAME tagged with correlation_id
+#define INVOCATION_FLAG_REQUEST_RESPONSE 0x1
+#define INVOCATION_FLAG_PAYLOAD_BLOB 0x2
+// import the function's code but do not call it, sent to a new installation before it takes traffic
+#define INVOCATION_FLAG_WARMUP 0x4
+
+#define INVOCATION_BLOB_DIR "blobs"
+#define INVOCATION_MAX_PAYLOAD_SIZE (6 * 1024 * 1024) // the same limits as aws lambda
+#define INVOCATION_MAX_RESULT_SIZE (6 * 1024 * 1024)
+
+#define INVOCATION_METADATA_FILE "function.metadata.json"
+
+struct InvocationEnvelope {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	uint64_t correlation_id; // 0 unless INVOCATION_FLAG_REQUEST_RESPONSE is set
+	char code_sha256[72]; // hex, nul terminated
+	char function_name[INVOCATION_FUNCTION_NAME_MAX]; // nul terminated
+	uint32_t payload_offset; // from the start of the element
+	uint32_t payload_length; // not counting the terminator
+	uint32_t blob_length; // the size of the file the payload names, with INVOCATION_FLAG_PAYLOAD_BLOB
+};
+
+#define INVOCATION_RESULT_BLOB 0x1
+
+struct InvocationResultHeader {
+	uint64_t correlation_id;
+	uint32_t flags;
+	uint32_t blob_length; // the size of the file the result names, with INVOCATION_RESULT_BLOB
+};
+
+// writes a blob file, returns -1 if it could not be written completely
+static inline int invocation_blob_write(const char *path, const char *data, size_t len) {
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+		return -1;
+	size_t written = fwrite(data, 1, len, f);
+	if (fclose(f) != 0 || written != len)
+		return -1;
+	return 0;
+}
+
+// reads a blob file of len bytes into a malloc'd, nul terminated buffer, NULL if it could not
+// be read or is not len bytes long
+static inline char *invocation_blob_read(const char *path, size_t len) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return NULL;
+	char *data = (char *)malloc(len + 1);
+	if (data == NULL || fread(data, 1, len, f) != len || fgetc(f) != EOF) {
+		free(data);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	data[len] = '\0';
+	return data;
+}
+
+#endif
@@ -8,20 +8,25 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <dirent.h>
+#include <signal.h>
+#include <ctype.h>
 #include <iostream>
 #include <cassert>
+#include <algorithm>
+#include <vector>
 
 #include <src/constants.h>
+#include <src/invocation_envelope.h>
 #include <lib/sha256_util.hpp>
 #include <lib/fsutil.hpp>
+#include <lib/nsplatform.h>
 
 
 #include "function_helpers.hpp"
 
 std::mutex used_function_name_lock;
 std::unordered_set<std::string> used_function_names;
-std::mutex lambda_functions_lock;
-std::unordered_map<std::string, std::shared_ptr<FunctionProperties>> lambda_functions;
 
 /*************************************************
     Function Properties method implementations
@@ -84,10 +89,14 @@ std::shared_ptr<FunctionProperties> FunctionProperties::installFunction() const
 	FunctionManager *mgr = this->getManager();
 	assert(mgr != NULL);
 
+	// every installation gets its own directory, even of the same code, so that a new one never
+	// clears out the directory of one that is still serving invocations
+	static std::atomic<unsigned long long> generation{0};
+
 	FunctionProperties copy = *this;
 	char install_path[2048];
-	snprintf(install_path, sizeof(install_path), "%s/%s-%s", mgr->install_base_dir.c_str(),
-		this->name.c_str(), this->src_zip_sha256.c_str());
+	snprintf(install_path, sizeof(install_path), "%s/%s-%s-%llu", mgr->install_base_dir.c_str(),
+		this->name.c_str(), this->src_zip_sha256.c_str(), ++generation);
 	
 	std::shared_ptr<FunctionInstallation> install = std::make_shared<FunctionInstallation>(copy, install_path);
 	return std::make_shared<FunctionProperties>(*this, install);
@@ -106,11 +115,18 @@ bool FunctionProperties::validateFunctionName(const char *str) {
  *************************************************/
 
 FunctionInstallation::FunctionInstallation(const FunctionProperties& func, const std::string& path)
-		: function(&func), install_path(path) {
-	
-	// initialize shared queue's 
-	queue_init(&(this->result_woof_queue), sizeof(struct ResultWooF), RESULT_WOOF_COUNT);
+		: function_name(func.name), manager(func.manager), install_path(path) {
+	// the destructor does not run if the constructor throws, whatever install got to (the
+	// directory, the platform, the worker process) is torn down here instead
+	try {
+		this->install(func);
+	} catch (...) {
+		this->teardown();
+		throw;
+	}
+}
 
+void FunctionInstallation::install(const FunctionProperties& func) {
 	FunctionManager *mgr = this->getManager();
 
 	std::cout << "cleaning out install location if it already exists" << std::endl;
@@ -118,9 +134,9 @@ FunctionInstallation::FunctionInstallation(const FunctionProperties& func, const
 
 	// create the directory if it does not exist
 	std::cout << "function install: creating directory for the function" << std::endl;
-	if (mkdir(path.c_str(), 0700) != 0) {
+	if (mkdir(this->install_path.c_str(), 0700) != 0) {
 		char error[1024];
-		snprintf(error, sizeof(error), "failed to create directory %s for the function installation", path.c_str());
+		snprintf(error, sizeof(error), "failed to create directory %s for the function installation", this->install_path.c_str());
 		throw AWSError(500, error);
 	}
 
@@ -128,13 +144,44 @@ FunctionInstallation::FunctionInstallation(const FunctionProperties& func, const
 	std::cout << "function install: unzipping the function source code" << std::endl;
 	{
 		char unzip_command[PATH_MAX + 128];
-		sprintf(unzip_command, "/usr/bin/unzip '%s' -d %s", this->function->src_zip_path.c_str(), this->install_path.c_str());
+		sprintf(unzip_command, "/usr/bin/unzip '%s' -d %s", func.src_zip_path.c_str(), this->install_path.c_str());
 		int retval = system(unzip_command);
 		if (retval != 0) {
 			throw AWSError(500, "unzip exited with non-zero return code, extraction was unsuccessful\n");
 		}
 	}
 
+	// payloads and results too large for a woof element are passed through files in here, the
+	// handler may run as another user in its container
+	{
+		std::string blob_dir = this->install_path + "/" + INVOCATION_BLOB_DIR;
+		if (mkdir(blob_dir.c_str(), 0777) != 0 || chmod(blob_dir.c_str(), 0777) != 0) {
+			throw AWSError(500, "failed to create the blob directory for the function installation");
+		}
+	}
+
+	// the handler reads the function's metadata from here once per version of the code, 
+	// invocations only carry the code sha256 (see src/invocation_envelope.h)
+	{
+		json_t *json = func.dumpJson();
+		char *metadata_str = json_dumps(json, JSON_COMPACT);
+		json_decref(json);
+		if (metadata_str == NULL) {
+			throw AWSError(500, "failed to dump the metadata JSON as a string");
+		}
+
+		char metadata_path[PATH_MAX + 64];
+		snprintf(metadata_path, sizeof(metadata_path), "%s/%s", this->install_path.c_str(), INVOCATION_METADATA_FILE);
+		FILE *metadata_file = fopen(metadata_path, "wb");
+		if (metadata_file == NULL) {
+			free(metadata_str);
+			throw AWSError(500, "failed to write the function metadata into the installation");
+		}
+		fputs(metadata_str, metadata_file);
+		fclose(metadata_file);
+		free(metadata_str);
+	}
+
 	// copy the binary's into the directory
 	char buffer1[PATH_MAX];
 	char buffer2[PATH_MAX];
@@ -151,105 +198,89 @@ FunctionInstallation::FunctionInstallation(const FunctionProperties& func, const
 	}
 
 	// spawn the woofc-namespace-platform process
-	std::cout << "function install: fork woofc-namespace-platform" << std::endl;
-	int nspid = this->woofcnamespace_pid = fork();
+	std::cout << "function install: starting woofc-namespace-platform" << std::endl;
+	char parallelism_buf[16];
+	sprintf(parallelism_buf, "%d", WPTHREAD_COUNT);
+	char *platform_argv[] = { (char *)"./woofc-namespace-platform", (char *)"-m", parallelism_buf, (char *)"-M", parallelism_buf, NULL };
+	int nspid = this->woofcnamespace_pid = nsplatform_spawn(this->install_path.c_str(), platform_argv);
 	if (nspid < 0) {
-		throw AWSError(500, "failed to fork the woofcnamespace platform");
-	} else if (nspid == 0) {
-		fprintf(stdout, "Subprocess: created the woofc-namespace-platform child process\n");
-
-		if (chdir(this->install_path.c_str()) != 0) {
-			fprintf(stdout, "Subprocess: Fatal error: failed to change to the function directory\n");
-			exit(0);
-		}
-
-		fprintf(stdout, "WooFCNamespacePlatform running for dir %s\n", this->install_path.c_str());
-		
-		char parallelism_buf[6];
-		sprintf(parallelism_buf, "%d", WPTHREAD_COUNT);
-		execl("./woofc-namespace-platform", "./woofc-namespace-platform", "-m", parallelism_buf, "-M", parallelism_buf, NULL);
-		exit(0);
-	} else {
-		fprintf(stdout, "WoofCNamespacePlatform PID: %d\n", nspid);
+		throw AWSError(500, "failed to start the woofcnamespace platform");
 	}
+	fprintf(stdout, "WoofCNamespacePlatform PID: %d\n", nspid);
 
-	sleep(1); // TODO: avoid race conditions, give the woofc-namespace-platform a bit of time to start up
-
-	// spawn the worker process
+	// spawn the worker process while the platform comes up
 	std::cout << "function install: creating the worker process" << std::endl;
-	WP *wp = this->wp = new WP;
+	WP *wp = new WP;
 	if (init_wp(wp, WORKER_QUEUE_DEPTH, wphandler_array, WPTHREAD_COUNT) < 0) {
+		delete wp;
 		throw AWSError(500, "failed to create the worker process");
 	}
+	this->wp = wp;
 
-	std::cout << "created the worker process successfully, woofinit the directory" << std::endl;
-	// change the workdir of the worker process to the correct directory & call WooFInit
+	// change the workdir of the worker process to the correct directory & call WooFInit, which
+	// succeeds once the platform has initialized the namespace. That does not mean it launches
+	// handlers yet, see the warm up below.
 	{
-		WPJob* theJob = create_job_easy(wp, wpcmd_initdir);
-		std::cout << "created the job easily" << std::endl;
-		struct wpcmd_initdir_arg *arg = (struct wpcmd_initdir_arg *)bp_getchunk(mgr->bp_jobobject_pool);
-		std::cout << "got myself a chunk of shared memory" << std::endl;
-		strcpy(arg->dir, this->install_path.c_str());
-		theJob->arg = arg;
-		std::cout << "about to invoke" << std::endl;
-		int retval = wp_job_invoke(wp, theJob);
-		std::cout << "invoked the job" << std::endl;
-		bp_freechunk(mgr->bp_jobobject_pool, (void *)arg);
-		std::cout << "free'd that chunk!" << std::endl;
+		auto probe = [](void *ctx) -> int {
+			FunctionInstallation *installation = (FunctionInstallation *)ctx;
+			FunctionManager *mgr = installation->getManager();
+			WPJob* theJob = create_job_easy(installation->wp, wpcmd_initdir);
+			struct wpcmd_initdir_arg *arg = (struct wpcmd_initdir_arg *)bp_getchunk(mgr->bp_jobobject_pool);
+			strcpy(arg->dir, installation->install_path.c_str());
+			theJob->arg = arg;
+			int retval = wp_job_invoke(installation->wp, theJob);
+			bp_freechunk(mgr->bp_jobobject_pool, (void *)arg);
+			return retval;
+		};
+		int retval = nsplatform_wait_ready(nspid, probe, this, NSPLATFORM_READY_TIMEOUT_MS);
 		if (retval < 0) {
-			throw AWSError(500, "failed to change the working directory of the worker process");
+			throw AWSError(500, "the woofcnamespace platform did not become ready");
 		}
 		fprintf(stdout, "worker process changed directory to function dir '%s'\n", this->install_path.c_str());
 	}
 	
-	// finally, create the result woof's 
-	int i;
-	for (i = 0; i < RESULT_WOOF_COUNT; ++i) {
+	// finally, create the result woof shared by all of the synchronous invocations
+	int resultseqno;
+	{
 		char woofpath[PATH_MAX];
-		char woofname[256];
-		sprintf(woofname, "result-%d.woof", i);
-		sprintf(woofpath, "%s/%s", this->install_path.c_str(), woofname);
-
-		fprintf(stdout, "seting up resultwoof %s (%s)\n", woofname, woofpath);
-
+		snprintf(woofpath, sizeof(woofpath), "%s/%s", this->install_path.c_str(), RESULT_WOOF_NAME);
 		unlink(woofpath);
 
-		{
-			fprintf(stderr, "Result WooF '%s' does not exist, making it\n", woofpath);
-
-			WPJob* theJob = create_job_easy(wp, wpcmd_woofcreate);
-			struct wpcmd_woofcreate_arg *arg =
-				(struct wpcmd_woofcreate_arg *)(theJob->arg = bp_getchunk(mgr->bp_jobobject_pool));
-			arg->el_size = RESULT_WOOF_EL_SIZE;
-			arg->queue_depth = 1; // result woof only needs to hold one result at a time
-			strcpy(arg->woofname, woofname);
-			fprintf(stdout, "Creating Result WooF %s\n", woofpath);
-			int retval = wp_job_invoke(wp, theJob);
-			bp_freechunk(mgr->bp_jobobject_pool, (void *)arg);
-			if (retval < 0) {
-				char error[1024];
-				sprintf(error, "Fatal error: failed to create result woof '%s'\n", woofname);
-				throw AWSError(500, error);
-			}
-		}
-		
-		WPJob* theJob = create_job_easy(wp, wpcmd_woofgetlatestseqno);
-		struct wpcmd_woofgetlatestseqno_arg *arg = 
-			(struct wpcmd_woofgetlatestseqno_arg *)(theJob->arg = bp_getchunk(mgr->bp_jobobject_pool));
-		strcpy(arg->woofname, woofname);
+		WPJob* theJob = create_job_easy(wp, wpcmd_woofcreate);
+		struct wpcmd_woofcreate_arg *arg =
+			(struct wpcmd_woofcreate_arg *)(theJob->arg = bp_getchunk(mgr->bp_jobobject_pool));
+		arg->el_size = RESULT_WOOF_EL_SIZE;
+		arg->queue_depth = RESULT_WOOF_QUEUE_DEPTH;
+		strcpy(arg->woofname, RESULT_WOOF_NAME);
+		fprintf(stdout, "Creating Result WooF %s\n", woofpath);
 		int retval = wp_job_invoke(wp, theJob);
 		bp_freechunk(mgr->bp_jobobject_pool, (void *)arg);
 		if (retval < 0) {
 			char error[1024];
-			sprintf(error, "Fatal error: failed to get seqno for result woof '%s' retval: %d\n", woofname, retval);
+			snprintf(error, sizeof(error), "Fatal error: failed to create result woof '%s'\n", RESULT_WOOF_NAME);
+			throw AWSError(500, error);
+		}
+		
+		// the handler signals the fifo after putting a result so that the waiter wakes up
+		// right away, see wpcmd_waitforresult
+		char notifypath[PATH_MAX + 16];
+		snprintf(notifypath, sizeof(notifypath), "%s" RESULT_WOOF_NOTIFY_SUFFIX, woofpath);
+		unlink(notifypath);
+		if (mkfifo(notifypath, 0666) != 0) {
+			fprintf(stderr, "failed to create the fifo %s, waiting for results will poll\n", notifypath);
+		}
+		
+		theJob = create_job_easy(wp, wpcmd_woofgetlatestseqno);
+		struct wpcmd_woofgetlatestseqno_arg *seqnoarg = 
+			(struct wpcmd_woofgetlatestseqno_arg *)(theJob->arg = bp_getchunk(mgr->bp_jobobject_pool));
+		strcpy(seqnoarg->woofname, RESULT_WOOF_NAME);
+		resultseqno = wp_job_invoke(wp, theJob);
+		bp_freechunk(mgr->bp_jobobject_pool, (void *)seqnoarg);
+		if (resultseqno < 0) {
+			char error[1024];
+			snprintf(error, sizeof(error), "Fatal error: failed to get seqno for result woof '%s' retval: %d\n", RESULT_WOOF_NAME, resultseqno);
 			throw AWSError(500, error);
 		}
-
-		// now get the latest seqno and insert it into the table
-		struct ResultWooF woof;
-		woof.seqno = retval;
-		strcpy(woof.woofname, woofname);
-		queue_put(&(this->result_woof_queue), &woof);
 	}
 
 	// and the invocation woof
@@ -274,35 +305,341 @@ FunctionInstallation::FunctionInstallation(const FunctionProperties& func, const
 
 		fprintf(stdout, "Created the WooF '%s' return code: %d\n", CALL_WOOF_NAME, retval);
 	}
+
+	this->result_router = std::thread(&FunctionInstallation::routeResults, this, mgr, resultseqno);
+
+	// the platform is ready once a warm up invocation makes the round trip through the handler,
+	// which also imports the function's code before the installation takes any invocations. A 
+	// probe whose handler was never launched is lost, so another one is put after a while and 
+	// the result of any of them will do.
+	{
+		struct ReadyProbe {
+			FunctionInstallation *installation;
+			const FunctionProperties *func;
+			std::vector<std::pair<uint64_t, std::future<std::string>>> sent;
+		} ready = { this, &func, {} };
+
+		auto probe = [](void *ctx) -> int {
+			ReadyProbe *ready = (ReadyProbe *)ctx;
+			uint64_t correlation_id;
+			std::future<std::string> result = ready->installation->putWarmUp(*ready->func, &correlation_id);
+			if (result.valid())
+				ready->sent.emplace_back(correlation_id, std::move(result));
+
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(NSPLATFORM_PROBE_ROUNDTRIP_MS);
+			do {
+				for (auto& sent : ready->sent) {
+					if (sent.second.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready)
+						return 0;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(NSPLATFORM_PROBE_MIN_MS));
+			} while (std::chrono::steady_clock::now() < deadline);
+			return -1;
+		};
+		int retval = nsplatform_wait_ready(nspid, probe, &ready, NSPLATFORM_READY_TIMEOUT_MS);
+		for (auto& sent : ready.sent)
+			this->results.abandon(sent.first);
+		if (retval < 0) {
+			throw AWSError(500, "the function's handler did not answer a warm up invocation");
+		}
+		fprintf(stdout, "warmed up installation %s\n", this->install_path.c_str());
+	}
+}
+
+void FunctionInstallation::routeResults(FunctionManager *mgr, int seqno) {
+	while (!this->stopping) {
+		WPJob* theJob = create_job_easy(this->wp, wpcmd_waitforresult);
+		struct wpcmd_waitforresult_arg *arg = 
+			(struct wpcmd_waitforresult_arg *)(theJob->arg = bp_getchunk(mgr->bp_jobobject_pool));
+		char *result = (char *)(theJob->result = bp_getchunk(mgr->bp_job_bigstringpool));
+		strcpy(arg->resultwoof.woofname, RESULT_WOOF_NAME);
+		arg->resultwoof.seqno = seqno;
+		arg->timeout = RESULT_ROUTER_WAIT_MS; // wake up now and then to check if we are stopping
+		
+		int retval = wp_job_invoke(this->wp, theJob);
+		int lost_from = arg->lost_from;
+		int lost_to = arg->lost_to;
+		bp_freechunk(mgr->bp_jobobject_pool, (void *)arg);
+
+		if (retval >= 0) {
+			seqno = retval;
+			struct InvocationResultHeader header;
+			memcpy(&header, result, sizeof(header));
+			result[RESULT_WOOF_EL_SIZE - 1] = '\0';
+			const char *value = result + sizeof(header);
+
+			// the lost results carried correlation ids we can not read anymore. Results come in
+			// roughly in the order of the invocations, so an invocation from before the oldest 
+			// result that is left is taken to be one of them rather than left to time out.
+			if (lost_from > 0) {
+				size_t failed = this->results.failBefore(header.correlation_id, 
+					"{\"errorType\": \"ResultLost\", \"errorMessage\": \"the result was overwritten before it was read\"}");
+				fprintf(stderr, "results %d to %d of %s were lost, failed %lu waiting invocations\n", 
+					lost_from, lost_to, this->install_path.c_str(), (unsigned long)failed);
+			}
+
+			// a result that did not fit was spilled into a file, the element holds its name
+			char *blob = NULL;
+			if (header.flags & INVOCATION_RESULT_BLOB) {
+				std::string blob_path = this->install_path + "/" + value;
+				bool in_blob_dir = strncmp(value, INVOCATION_BLOB_DIR "/", strlen(INVOCATION_BLOB_DIR) + 1) == 0 && 
+					strstr(value, "..") == NULL;
+				if (in_blob_dir) {
+					if (header.blob_length <= INVOCATION_MAX_RESULT_SIZE)
+						blob = invocation_blob_read(blob_path.c_str(), header.blob_length);
+					unlink(blob_path.c_str());
+				}
+				if (blob == NULL) {
+					fprintf(stderr, "failed to read the result of invocation %llu from '%s'\n", 
+						(unsigned long long)header.correlation_id, value);
+					value = "{\"errorMessage\": \"failed to read the result\"}";
+				} else {
+					value = blob;
+				}
+			}
+
+			if (!this->results.deliver(header.correlation_id, value)) {
+				fprintf(stderr, "dropping the result of invocation %llu, nobody is waiting for it\n", 
+					(unsigned long long)header.correlation_id);
+			}
+			free(blob);
+		} else if (retval == -2) {
+			fprintf(stderr, "failed to read result woof '%s' in %s, retrying\n", RESULT_WOOF_NAME, this->install_path.c_str());
+			usleep(100000);
+		}
+		
+		bp_freechunk(mgr->bp_job_bigstringpool, (void *)result);
+	}
+}
+
+std::future<std::string> FunctionInstallation::putWarmUp(const FunctionProperties& func, uint64_t *correlation_id) {
+	FunctionManager *mgr = this->getManager();
+	const char *payload = "{}";
+
+	struct InvocationEnvelope envelope;
+	memset(&envelope, 0, sizeof(envelope));
+	if (func.name.length() >= sizeof(envelope.function_name) || func.src_zip_sha256.length() >= sizeof(envelope.code_sha256))
+		return std::future<std::string>();
+
+	// called from nsplatform_wait_ready, nothing may be thrown through it
+	std::future<std::string> result;
+	try {
+		result = this->results.expect(correlation_id);
+	} catch (const AWSError &e) {
+		return std::future<std::string>();
+	}
+
+	envelope.magic = INVOCATION_ENVELOPE_MAGIC;
+	envelope.version = INVOCATION_ENVELOPE_VERSION;
+	envelope.flags = INVOCATION_FLAG_REQUEST_RESPONSE | INVOCATION_FLAG_WARMUP;
+	envelope.correlation_id = *correlation_id;
+	strcpy(envelope.code_sha256, func.src_zip_sha256.c_str());
+	strcpy(envelope.function_name, func.name.c_str());
+	envelope.payload_offset = sizeof(envelope);
+	envelope.payload_length = strlen(payload);
+
+	char *element = (char *)bp_getchunk(mgr->bp_job_bigstringpool);
+	memset(element, 0, CALL_WOOF_EL_SIZE);
+	memcpy(element, &envelope, sizeof(envelope));
+	memcpy(element + sizeof(envelope), payload, envelope.payload_length);
+
+	WPJob* theJob = create_job_easy(this->wp, wpcmd_invoke);
+	theJob->arg = element;
+	int retval = wp_job_invoke(this->wp, theJob);
+	bp_freechunk(mgr->bp_job_bigstringpool, (void *)element);
+
+	if (retval < 0) {
+		this->results.abandon(*correlation_id);
+		return std::future<std::string>();
+	}
+	return result;
 }
 
 FunctionInstallation::~FunctionInstallation() {
-	std::cout << "cleanup installation for function: '" << this->function->name << "' location: " << this->install_path << std::endl;
+	this->teardown();
+}
+
+void FunctionInstallation::teardown() {
+	std::cout << "cleanup installation for function: '" << this->function_name << "' location: " << this->install_path << std::endl;
+	
+	this->stopping = true;
+	if (this->result_router.joinable())
+		this->result_router.join();
+
 	rmrfdir(this->install_path.c_str());
 	
-	queue_free(&(this->result_woof_queue));
-	if (this->wp != NULL)
+	if (this->wp != NULL) {
 		free_wp(this->wp);
-	if (woofcnamespace_pid != -1)
+		delete this->wp;
+		this->wp = NULL;
+	}
+	if (this->woofcnamespace_pid != -1) {
 		kill(this->woofcnamespace_pid, SIGTERM);
+		this->woofcnamespace_pid = -1;
+	}
 }
 
 
-FunctionManager::FunctionManager() {
+bool FunctionInstallation::enter() {
+	this->inflight++;
+	if (this->closing) {
+		this->leave();
+		return false;
+	}
+	return true;
+}
+
+void FunctionInstallation::leave() {
+	this->inflight--;
+}
+
+bool FunctionInstallation::tryClose() {
+	// pairs with enter, an invocation either sees closing or is counted here
+	this->closing = true;
+	return this->inflight == 0;
+}
+
+std::future<std::string> InvocationResultRouter::expect(uint64_t *correlation_id) {
+	std::unique_lock<std::mutex> g(this->lock);
+	if (!this->slot_freed.wait_for(g, std::chrono::milliseconds(RESULT_TIMEOUT_MS), 
+			[this]() { return this->waiting.size() < RESULT_WOOF_QUEUE_DEPTH; })) {
+		throw AWSError(429, "TooManyRequestsException");
+	}
+	*correlation_id = this->next_correlation_id++;
+	return this->waiting[*correlation_id].get_future();
+}
+
+void InvocationResultRouter::abandon(uint64_t correlation_id) {
+	std::lock_guard<std::mutex> g(this->lock);
+	if (this->waiting.erase(correlation_id) != 0)
+		this->slot_freed.notify_one();
+}
+
+bool InvocationResultRouter::deliver(uint64_t correlation_id, const char *result) {
+	std::lock_guard<std::mutex> g(this->lock);
+	auto waiter = this->waiting.find(correlation_id);
+	if (waiter == this->waiting.end())
+		return false;
+	waiter->second.set_value(result);
+	this->waiting.erase(waiter);
+	this->slot_freed.notify_one();
+	return true;
+}
+
+size_t InvocationResultRouter::failBefore(uint64_t correlation_id, const char *result) {
+	std::lock_guard<std::mutex> g(this->lock);
+	size_t failed = 0;
+	auto waiter = this->waiting.begin();
+	while (waiter != this->waiting.end() && waiter->first < correlation_id) {
+		waiter->second.set_value(result);
+		waiter = this->waiting.erase(waiter);
+		failed++;
+	}
+	if (failed > 0)
+		this->slot_freed.notify_all();
+	return failed;
+}
+
+FunctionManager::FunctionManager(const std::string& install_base_dir, const std::string& metadata_base_dir) 
+	: install_base_dir(install_base_dir), metadata_base_dir(metadata_base_dir) {
+	this->lambda_functions = std::make_shared<FunctionTable>();
 	this->bp_jobobject_pool = sharedbuffpool_create(sizeof(union wpcmd_job_data_types), OBJECT_POOL_SIZE);
 	this->bp_job_bigstringpool = sharedbuffpool_create(MAX_WOOF_EL_SIZE, OBJECT_POOL_SIZE);
+	this->removeStaleInstallations();
+	this->reaper = std::thread(&FunctionManager::reapInstallations, this);
+}
+
+// installation directories are named <function name>-<code sha256>-<generation>, see 
+// FunctionProperties::installFunction
+static bool isInstallationDirName(const char *name) {
+	const char *generation = strrchr(name, '-');
+	if (generation == NULL || generation[1] == '\0' || strspn(generation + 1, "0123456789") != strlen(generation + 1))
+		return false;
+	size_t sha_end = generation - name;
+	if (sha_end < 64 + 2 || name[sha_end - 65] != '-')
+		return false;
+	for (size_t i = sha_end - 64; i < sha_end; i++) {
+		if (!isxdigit((unsigned char)name[i]))
+			return false;
+	}
+	return true;
+}
+
+// sends SIGTERM to every process whose working directory is in dir, e.g. the namespace platform
+// and the containers of an installation whose lambda_client exited without tearing it down
+static void stopProcessesIn(const char *dir) {
+	char dirpath[PATH_MAX];
+	if (realpath(dir, dirpath) == NULL)
+		return ;
+	size_t dirlen = strlen(dirpath);
+
+	DIR *proc = opendir("/proc");
+	if (proc == NULL)
+		return ;
+	struct dirent *ent;
+	while ((ent = readdir(proc)) != NULL) {
+		if (strspn(ent->d_name, "0123456789") != strlen(ent->d_name))
+			continue;
+		pid_t pid = (pid_t)atoi(ent->d_name);
+		if (pid == getpid())
+			continue;
+
+		char link[64];
+		char cwd[PATH_MAX];
+		snprintf(link, sizeof(link), "/proc/%s/cwd", ent->d_name);
+		ssize_t len = readlink(link, cwd, sizeof(cwd) - 1);
+		if (len < 0)
+			continue;
+		cwd[len] = '\0';
+		if (strncmp(cwd, dirpath, dirlen) == 0 && (cwd[dirlen] == '\0' || cwd[dirlen] == '/')) {
+			fprintf(stdout, "stopping process %d left running in %s\n", (int)pid, dir);
+			kill(pid, SIGTERM);
+		}
+	}
+	closedir(proc);
+}
+
+void FunctionManager::removeStaleInstallations() {
+	// nothing is installed yet, every installation directory belongs to an earlier run
+	DIR *dir = opendir(this->install_base_dir.c_str());
+	if (dir == NULL)
+		return ;
+	std::vector<std::string> stale;
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != NULL) {
+		if (isInstallationDirName(ent->d_name))
+			stale.push_back(this->install_base_dir + "/" + ent->d_name);
+	}
+	closedir(dir);
+
+	for (const std::string& path : stale) {
+		fprintf(stdout, "removing the stale installation %s\n", path.c_str());
+		stopProcessesIn(path.c_str());
+		if (rmrfdir(path.c_str()) != 0)
+			fprintf(stderr, "failed to remove the stale installation %s\n", path.c_str());
+	}
 }
 	
 FunctionManager::~FunctionManager() {
+	{
+		std::lock_guard<std::mutex> g(this->reaper_lock);
+		this->reaper_stopping = true;
+	}
+	this->reaper_wakeup.notify_all();
+	this->reaper.join();
+
 	sharedbuffpool_free(this->bp_jobobject_pool);
 	sharedbuffpool_free(this->bp_job_bigstringpool);
 }
 
 bool FunctionManager::functionExists(const char *funcname) {
-	std::lock_guard<std::mutex> g(this->lambda_functions_lock);
-	if (lambda_functions.find(funcname) != lambda_functions.end()) {
+	std::shared_ptr<const FunctionTable> table = this->snapshot();
+	if (table->functions.find(funcname) != table->functions.end()) {
 		return true;
 	}
+	if (table->missing.find(funcname) != table->missing.end()) {
+		return false;
+	}
 
 	if (!FunctionProperties::validateFunctionName(funcname)) {
 		return false;
@@ -312,16 +649,42 @@ bool FunctionManager::functionExists(const char *funcname) {
 	this->metadata_path_for_function(funcname, path);
 	fprintf(stdout, "checking if function metadata exists at path: %s\n", path);
 	
-	return access(path, F_OK) != -1;
+	if (access(path, F_OK) != -1) {
+		return true;
+	}
+
+	// remember the name so that the next lookup does not have to check the file system, unless
+	// the function was created while we were checking
+	std::lock_guard<std::mutex> g(this->lambda_functions_lock);
+	std::shared_ptr<FunctionTable> updated = this->copyTable();
+	if (updated->functions.find(funcname) == updated->functions.end()) {
+		if (updated->missing.size() >= MAX_MISSING_FUNCTION_NAMES)
+			updated->missing.clear();
+		updated->missing.insert(funcname);
+		this->publishTable(updated);
+	}
+	return false;
 }
 
 void FunctionManager::removeFunction(const char *funcname) {
-	std::lock_guard<std::mutex> g(this->lambda_functions_lock);
+	std::shared_ptr<FunctionInstallation> retired;
+	{
+		std::lock_guard<std::mutex> g(this->lambda_functions_lock);
 
-	this->lambda_functions.erase(funcname);
-	char path[PATH_MAX];
-	this->metadata_path_for_function(funcname, path);
-	remove(path);
+		std::shared_ptr<FunctionTable> updated = this->copyTable();
+		auto current = updated->functions.find(funcname);
+		if (current != updated->functions.end()) {
+			retired = current->second->installation;
+			updated->functions.erase(current);
+		}
+		updated->pending.erase(funcname);
+		this->publishTable(updated);
+
+		char path[PATH_MAX];
+		this->metadata_path_for_function(funcname, path);
+		remove(path);
+	}
+	this->retireInstallation(retired);
 }
 
 void FunctionManager::addFunction(std::shared_ptr<FunctionProperties>& func) {
@@ -329,14 +692,25 @@ void FunctionManager::addFunction(std::shared_ptr<FunctionProperties>& func) {
 
 	{
 		std::lock_guard<std::mutex> g(this->lambda_functions_lock);
-		this->lambda_functions.erase(func->name);
-		this->lambda_functions[func->name] = func;
+		std::shared_ptr<FunctionTable> updated = this->copyTable();
+		auto current = updated->functions.find(func->name);
+		if (current != updated->functions.end() && current->second->isInstalled()) {
+			// an installed version keeps serving invocations until the new one is installed, 
+			// unless they are the same code
+			if (current->second->src_zip_sha256 != func->src_zip_sha256)
+				updated->pending[func->name] = func;
+			else
+				updated->pending.erase(func->name);
+		} else {
+			updated->functions[func->name] = func;
+			updated->pending.erase(func->name);
+		}
+		updated->missing.erase(func->name);
+		this->publishTable(updated);
 
 		fprintf(stdout, "function manager adding function '%s' (hash: %s)\n", 
 			func->name.c_str(),
 			func->src_zip_sha256.c_str());
-		fprintf(stdout, "the hash of the function now in the manager is: %s\n", 
-		this->lambda_functions[func->name]->src_zip_sha256.c_str());
 	}
 
 	json_t *json = func->dumpJson();
@@ -367,11 +741,31 @@ void FunctionManager::addFunction(std::shared_ptr<FunctionProperties>& func) {
 	free(metadata_str);
 }
 
+std::shared_ptr<const FunctionProperties> FunctionManager::getDeployedFunction(const char *funcname) {
+	{
+		std::shared_ptr<const FunctionTable> table = this->snapshot();
+		auto pending = table->pending.find(funcname);
+		if (pending != table->pending.end()) {
+			return pending->second;
+		}
+	}
+	return this->getFunction(funcname);
+}
+
 std::shared_ptr<const FunctionProperties> FunctionManager::getFunction(const char *funcname) {
-	std::lock_guard<std::mutex> g(this->lambda_functions_lock);
+	{
+		std::shared_ptr<const FunctionTable> table = this->snapshot();
+		auto result = table->functions.find(funcname);
+		if (result != table->functions.end()) {
+			return result->second;
+		}
+	}
 
-	auto result = this->lambda_functions.find(funcname);
-	if (result != this->lambda_functions.end()) {
+	// not loaded yet, read its metadata
+	std::lock_guard<std::mutex> g(this->lambda_functions_lock);
+	std::shared_ptr<FunctionTable> updated = this->copyTable();
+	auto result = updated->functions.find(funcname);
+	if (result != updated->functions.end()) {
 		return result->second;
 	}
 	
@@ -388,7 +782,9 @@ std::shared_ptr<const FunctionProperties> FunctionManager::getFunction(const cha
 		func->manager = this;
 		json_decref(metadata);
 
-		this->lambda_functions[funcname] = func;
+		updated->functions[funcname] = func;
+		updated->missing.erase(funcname);
+		this->publishTable(updated);
 		return func;
 	} catch (const AWSError& e) {
 		json_decref(metadata);
@@ -399,13 +795,211 @@ std::shared_ptr<const FunctionProperties> FunctionManager::getFunction(const cha
 void FunctionManager::installFunction(std::shared_ptr<const FunctionProperties>& func) {
 	if (func->isInstalled()) 
 		return ;
-	std::lock_guard<std::mutex> g(this->create_function_lock);
-	std::shared_ptr<const FunctionProperties> funcNow = this->getFunction(func->name.c_str());
+	func = this->startInstall(func, false).get(); // rethrows the AWSError if the install failed
+}
+
+void FunctionManager::recordFailedInstall(const std::string& key, const std::string& reason) {
+	std::lock_guard<std::mutex> g(this->installs_lock);
+	FailedInstall& failed = this->failed_installs[key];
+	failed.reason = reason;
+	failed.attempts++;
+	long backoff_s = INSTALL_RETRY_MIN_DELAY_S << std::min(failed.attempts - 1, 16);
+	if (backoff_s > INSTALL_RETRY_MAX_DELAY_S)
+		backoff_s = INSTALL_RETRY_MAX_DELAY_S;
+	failed.retry_after = std::chrono::steady_clock::now() + std::chrono::seconds(backoff_s);
+}
+
+void FunctionManager::retryPendingInstall(const char *funcname) {
+	std::shared_ptr<const FunctionProperties> pending;
+	{
+		std::shared_ptr<const FunctionTable> table = this->snapshot();
+		auto result = table->pending.find(funcname);
+		if (result == table->pending.end())
+			return ;
+		pending = result->second;
+	}
+
+	std::string key = pending->name + ":" + pending->src_zip_sha256;
+	{
+		std::lock_guard<std::mutex> g(this->installs_lock);
+		auto failed = this->failed_installs.find(key);
+		if (failed == this->failed_installs.end() || 
+			std::chrono::steady_clock::now() < failed->second.retry_after)
+			return ; // still installing, or not time to retry yet
+		fprintf(stdout, "retrying install of function %s after %d failures\n", key.c_str(), failed->second.attempts);
+	}
+	this->startInstall(pending, true);
+}
+
+void FunctionManager::installFunctionAsync(std::shared_ptr<const FunctionProperties> func) {
+	if (!func->isInstalled())
+		this->startInstall(func, true);
+}
+
+FunctionManager::InstallFuture FunctionManager::startInstall(std::shared_ptr<const FunctionProperties> func, bool background) {
+	// one install per version of a function, whoever gets here first starts it and everybody 
+	// else waits on its future. No lock is held while installing.
+	std::string key = func->name + ":" + func->src_zip_sha256;
+	std::shared_ptr<std::promise<std::shared_ptr<const FunctionProperties>>> promise = 
+		std::make_shared<std::promise<std::shared_ptr<const FunctionProperties>>>();
+	InstallFuture install;
+	{
+		std::lock_guard<std::mutex> g(this->installs_lock);
+		{
+			// the install may have finished after the caller looked the function up
+			std::shared_ptr<const FunctionTable> table = this->snapshot();
+			auto current = table->functions.find(func->name);
+			if (current != table->functions.end() && current->second->isInstalled() && 
+				current->second->src_zip_sha256 == func->src_zip_sha256) {
+				promise->set_value(current->second);
+				return promise->get_future().share();
+			}
+		}
+
+		auto inflight = this->installs.find(key);
+		if (inflight != this->installs.end()) {
+			return inflight->second;
+		}
+		install = this->installs[key] = promise->get_future().share();
+	}
+
+	auto run = [this, func, key, promise]() {
+		try {
+			// the installation has imported the code once already, see FunctionInstallation::install
+			std::shared_ptr<const FunctionProperties> installed = func->installFunction();
+
+			// swap it in unless the function was updated or removed in the meantime, the caller
+			// still gets to use this version
+			std::shared_ptr<FunctionInstallation> retired;
+			{
+				std::lock_guard<std::mutex> g(this->lambda_functions_lock);
+				std::shared_ptr<FunctionTable> updated = this->copyTable();
+				auto pending = updated->pending.find(func->name);
+				auto current = updated->functions.find(func->name);
+				if (pending != updated->pending.end()) {
+					if (pending->second->src_zip_sha256 == func->src_zip_sha256 && current != updated->functions.end()) {
+						retired = current->second->installation;
+						current->second = installed;
+						updated->pending.erase(pending);
+						this->publishTable(updated);
+					}
+				} else if (current != updated->functions.end() && !current->second->isInstalled() &&
+					current->second->src_zip_sha256 == func->src_zip_sha256) {
+					current->second = installed;
+					this->publishTable(updated);
+				}
+			}
+			this->retireInstallation(retired);
+			{
+				std::lock_guard<std::mutex> g(this->installs_lock);
+				this->failed_installs.erase(key);
+			}
+			promise->set_value(installed);
+		} catch (const AWSError &e) {
+			fprintf(stderr, "failed to install function %s: %s\n", key.c_str(), e.msg.c_str());
+			this->recordFailedInstall(key, e.msg);
+			promise->set_exception(std::current_exception());
+		} catch (...) {
+			this->recordFailedInstall(key, "InternalError");
+			promise->set_exception(std::current_exception());
+		}
+
+		std::lock_guard<std::mutex> g(this->installs_lock);
+		this->installs.erase(key);
+	};
+
+	if (background) {
+		std::thread(run).detach();
+	} else {
+		run();
+	}
+	return install;
+}
+
+void FunctionManager::retireInstallation(std::shared_ptr<FunctionInstallation> installation) {
+	if (installation == nullptr)
+		return ;
 
-	// check if another thread jumped in and installed the function before we got to hold the create function lock
-	if (!funcNow->isInstalled()) {
-		// finally, install the function while holding the lock
-		std::lock_guard<std::mutex> g2(this->lambda_functions_lock);
-		this->lambda_functions[funcNow->name] = funcNow->installFunction();
+	// invocations are counted until they return (see FunctionInstallation::enter), the delay is
+	// for asynchronous ones that may still be running in the namespace after their put returned
+	fprintf(stdout, "retiring installation %s in %d seconds\n", installation->install_path.c_str(), (int)INSTALLATION_RETIRE_DELAY_S);
+	{
+		std::lock_guard<std::mutex> g(this->reaper_lock);
+		this->retiring.emplace(std::chrono::steady_clock::now() + std::chrono::seconds(INSTALLATION_RETIRE_DELAY_S), 
+			std::move(installation));
 	}
+	this->reaper_wakeup.notify_all();
+}
+
+void FunctionManager::reapInstallations() {
+	std::unique_lock<std::mutex> g(this->reaper_lock);
+	while (!this->reaper_stopping) {
+		if (this->retiring.empty()) {
+			this->reaper_wakeup.wait(g);
+			continue;
+		}
+
+		auto next = this->retiring.begin();
+		if (std::chrono::steady_clock::now() < next->first) {
+			this->reaper_wakeup.wait_until(g, next->first);
+			continue;
+		}
+
+		std::shared_ptr<FunctionInstallation> installation = std::move(next->second);
+		this->retiring.erase(next);
+		if (!installation->tryClose()) {
+			// invocations are still running in it, new ones look the function up again
+			this->retiring.emplace(std::chrono::steady_clock::now() + std::chrono::seconds(INSTALLATION_REAP_RECHECK_S), 
+				std::move(installation));
+			continue;
+		}
+
+		// tearing it down joins its result router and stops its processes, not under the lock
+		g.unlock();
+		installation.reset();
+		g.lock();
+	}
+
+	// the manager is going away, so are the installations that were still retiring
+	std::multimap<std::chrono::steady_clock::time_point, std::shared_ptr<FunctionInstallation>> remaining;
+	remaining.swap(this->retiring);
+	g.unlock();
+	remaining.clear();
+}
+
+const char *FunctionManager::functionState(const FunctionProperties& func, std::string& reason) {
+	if (func.isInstalled())
+		return "Active";
+
+	{
+		// the same code may already be installed under another copy of the properties
+		std::shared_ptr<const FunctionTable> table = this->snapshot();
+		auto current = table->functions.find(func.name);
+		if (current != table->functions.end() && current->second->isInstalled() &&
+			current->second->src_zip_sha256 == func.src_zip_sha256)
+			return "Active";
+	}
+
+	std::string key = func.name + ":" + func.src_zip_sha256;
+	std::lock_guard<std::mutex> g(this->installs_lock);
+	if (this->installs.find(key) != this->installs.end())
+		return "Pending";
+	auto failed = this->failed_installs.find(key);
+	if (failed != this->failed_installs.end()) {
+		reason = failed->second.reason;
+		return "Failed";
+	}
+	return "Inactive"; // installed by the next invocation
+}
+
+json_t *FunctionManager::dumpFunctionConfiguration(const FunctionProperties& func) {
+	json_t *json = func.dumpJson();
+	std::string reason;
+	const char *state = this->functionState(func, reason);
+	json_object_set_new(json, "State", json_string(state));
+	if (!reason.empty())
+		json_object_set_new(json, "StateReason", json_string(reason.c_str()));
+	json_object_set_new(json, "LastUpdateStatus", json_string(
+		strcmp(state, "Pending") == 0 ? "InProgress" : strcmp(state, "Failed") == 0 ? "Failed" : "Successful"));
+	return json;
 }
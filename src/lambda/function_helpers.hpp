@@ -2,11 +2,18 @@
 #define FUNCTIONHELPERS_HPP
 
 #include <unordered_map>
+#include <map>
 #include <unordered_set>
 #include <mutex>
+#include <condition_variable>
 #include <string>
 #include <exception>
 #include <memory>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 
 #include <lib/utility.h>
 #include <src/constants.h>
@@ -64,67 +71,222 @@ public:
 	json_t *dumpJson() const;
 };
 
+// hands the results read from an installation's result woof to the invocations waiting for them,
+// results are matched up with their invocation by correlation id
+class InvocationResultRouter {
+	std::mutex lock;
+	std::condition_variable slot_freed;
+	std::map<uint64_t, std::promise<std::string>> waiting; // ordered, see failBefore
+	uint64_t next_correlation_id = 1;
+
+public:
+	// registers an invocation and assigns its correlation id, call it before the invocation is
+	// put so that the result can not arrive before anybody is waiting for it. At most 
+	// RESULT_WOOF_QUEUE_DEPTH invocations wait at a time so that their results fit in the result
+	// woof, throws AWSError 429 if no slot frees up within RESULT_TIMEOUT_MS.
+	std::future<std::string> expect(uint64_t *correlation_id);
+
+	// stop waiting for an invocation that failed or timed out, its result is dropped if it comes
+	void abandon(uint64_t correlation_id);
+
+	// returns false if no invocation is waiting for the result
+	bool deliver(uint64_t correlation_id, const char *result);
+
+	// gives result to every invocation registered before correlation_id that is still waiting,
+	// returns how many there were
+	size_t failBefore(uint64_t correlation_id, const char *result);
+};
+
 struct FunctionInstallation {
-	const FunctionProperties *function;
+	// the FunctionProperties the installation was made from is a temporary, keep what we need
+	std::string function_name;
+	FunctionManager *manager;
 
 	std::string install_path;
 
 	WP *wp = nullptr;
 	int woofcnamespace_pid = -1;
-	Queue result_woof_queue;
+
+	InvocationResultRouter results;
+	std::atomic<uint64_t> next_blob_id{1}; // names the files payloads that do not fit are spilled to
+
+	// invocations running in the installation, the reaper only tears it down once there are none
+	std::atomic<int> inflight{0};
+	// set by the reaper, invocations no longer enter the installation after that
+	std::atomic<bool> closing{false};
 	
 	FunctionInstallation(const FunctionProperties& func, const std::string& path);
 	~FunctionInstallation();
 
 	inline FunctionManager* getManager()  {
-		return this->function->manager;
+		return this->manager;
 	}
+
+	// counts an invocation as running until leave is called, returns false if the installation
+	// was closed already and the function has to be looked up again
+	bool enter();
+	void leave();
+
+	// closes the installation to new invocations, returns true if none are running
+	bool tryClose();
+
+private:
+	std::thread result_router;
+	std::atomic<bool> stopping{false};
+
+	// reads the result woof from seqno on and delivers each result until the installation stops
+	void routeResults(FunctionManager *mgr, int seqno);
+
+	// puts an invocation that makes the handler import the function's code without calling it,
+	// which leaves the compiled bytecode in the installation for the invocations that follow.
+	// The future gets the (null) result, it is invalid if the put failed.
+	std::future<std::string> putWarmUp(const FunctionProperties& func, uint64_t *correlation_id);
+
+	// the body of the constructor, and the cleanup shared by the destructor and a failed install
+	void install(const FunctionProperties& func);
+	void teardown();
 };
 
+// an invocation that entered the installation, leaves it when it goes out of scope
+class InstallationInvocation {
+	FunctionInstallation *installation;
+public:
+	InstallationInvocation(FunctionInstallation *installation) : installation(installation) {}
+	~InstallationInvocation() {
+		this->installation->leave();
+	}
+	InstallationInvocation(const InstallationInvocation&) = delete;
+	InstallationInvocation& operator=(const InstallationInvocation&) = delete;
+};
+
+#define MAX_MISSING_FUNCTION_NAMES 4096
+
 struct FunctionManager {
 protected:
-	// these are private to the implementation, may be acquired by various operations
+	// the function table is an immutable snapshot, lookups load it with std::atomic_load and 
+	// never take a lock. Changes copy it and publish the copy while holding lambda_functions_lock.
+	struct FunctionTable {
+		// the version of each function that invocations use
+		std::unordered_map<std::string, std::shared_ptr<const FunctionProperties>> functions;
+		// a newer version that is still being installed, it replaces the one in functions once
+		// it is ready (see startInstall)
+		std::unordered_map<std::string, std::shared_ptr<const FunctionProperties>> pending;
+		std::unordered_set<std::string> missing; // names that are known to have no function
+	};
+
 	std::mutex lambda_functions_lock;
-	std::unordered_map<std::string, std::shared_ptr<const FunctionProperties>> lambda_functions;
+	std::shared_ptr<const FunctionTable> lambda_functions;
+
+	std::shared_ptr<const FunctionTable> snapshot() const {
+		return std::atomic_load(&this->lambda_functions);
+	}
+
+	// you must hold lambda_functions_lock from copyTable until publishTable
+	std::shared_ptr<FunctionTable> copyTable() const {
+		return std::make_shared<FunctionTable>(*this->snapshot());
+	}
+
+	void publishTable(const std::shared_ptr<FunctionTable>& table) {
+		std::atomic_store(&this->lambda_functions, std::shared_ptr<const FunctionTable>(table));
+	}
+
+	typedef std::shared_future<std::shared_ptr<const FunctionProperties>> InstallFuture;
+
+	struct FailedInstall {
+		std::string reason;
+		int attempts = 0; // consecutive failures, cleared once an install succeeds
+		std::chrono::steady_clock::time_point retry_after;
+	};
+
+	// installs in progress and the last failure of each install, by function name + code 
+	// sha256, see installFunction
+	std::mutex installs_lock;
+	std::unordered_map<std::string, InstallFuture> installs;
+	std::unordered_map<std::string, FailedInstall> failed_installs;
+
+	// returns the future of the install of func, starting the install on this thread or in the 
+	// background if it is not installed or being installed already
+	InstallFuture startInstall(std::shared_ptr<const FunctionProperties> func, bool background);
+
+	// remembers why an install failed and when it may be retried, see retryPendingInstall
+	void recordFailedInstall(const std::string& key, const std::string& reason);
+
+	// hands an installation that is no longer used to the reaper, which tears it down after a 
+	// delay once no invocation is running in it
+	void retireInstallation(std::shared_ptr<FunctionInstallation> installation);
+
+	// retired installations by the time they may be torn down. reapInstallations drops them 
+	// once they are closed, the teardown runs wherever the last reference goes, normally there.
+	std::mutex reaper_lock;
+	std::condition_variable reaper_wakeup;
+	std::multimap<std::chrono::steady_clock::time_point, std::shared_ptr<FunctionInstallation>> retiring;
+	bool reaper_stopping = false;
+	std::thread reaper;
+
+	void reapInstallations();
+
+	// removes the installation directories left behind by an earlier run, along with the woofs
+	// in them, and stops the processes still running in them
+	void removeStaleInstallations();
 
 public:
 	
 	SharedBufferPool *bp_jobobject_pool;
 	SharedBufferPool *bp_job_bigstringpool;
 
-	// long held lock, only one thread can be creating a function at a time
-	// also used to prevent multiple threads from installing a function at the same time
-	// and any other long running operation
+	// long held lock, only one thread can be creating, updating or deleting a function at a time
+	// installing functions does not take it, see installFunction
 	// TODO: this REALLY needs a better name, it is basically used any place an operation can not be done in parallel
-	// such as installing functions on the local machine, for example.
 	std::mutex create_function_lock;
 
-	// you must set these values, no trailing slashes 
-	std::string install_base_dir;
-	std::string metadata_base_dir;
+	// no trailing slashes, both directories must exist when the manager is created
+	const std::string install_base_dir;
+	const std::string metadata_base_dir;
 
-	FunctionManager();
+	FunctionManager(const std::string& install_base_dir, const std::string& metadata_base_dir);
 	virtual ~FunctionManager();
 
 	// NOTE: you must NOT be holding the lambda_functions_lock when you call this or 
-	// dead lock will occur 
+	// dead lock will occur. Answered from the function table when the name has been seen before.
 	virtual bool functionExists(const char *funcname);
 
 	// throws AWSError
 	virtual void removeFunction(const char *funcname);
 	
-	// you must have acquired both lambda_functions_lock and create_function_lock to run this 
+	// you must have acquired create_function_lock to run this 
 	// throws AWSError
 	virtual void addFunction(std::shared_ptr<FunctionProperties>& func);
 
-	// load function
+	// load function, the version invocations should use
 	// throws AWSError
 	virtual std::shared_ptr<const FunctionProperties> getFunction(const char *funcname);
 
-	// install the function on the local machine so that execution can begin
+	// the most recently deployed version of the function, which may still be installing
+	// throws AWSError
+	virtual std::shared_ptr<const FunctionProperties> getDeployedFunction(const char *funcname);
+
+	// install the function on the local machine so that execution can begin, func is replaced 
+	// with the installed version. Concurrent calls for the same version of a function share one 
+	// install, different functions install in parallel.
 	// throws AWSError 
 	virtual void installFunction(std::shared_ptr<const FunctionProperties>& func);
 
+	// starts installing the function on a background thread and returns right away, used when
+	// a function is created or updated so that its first invocation finds it installed
+	virtual void installFunctionAsync(std::shared_ptr<const FunctionProperties> func);
+
+	// restarts the background install of a pending version whose last install failed, once its
+	// backoff has passed. Invocations keep using the old version and would never install it.
+	virtual void retryPendingInstall(const char *funcname);
+
+	// the state of the function as aws lambda reports it: Pending while it is being installed,
+	// Active once it is, Failed (with the reason) if the last install failed and Inactive if 
+	// it has not been installed
+	const char *functionState(const FunctionProperties& func, std::string& reason);
+
+	// dumpJson plus the function's state, for api responses
+	json_t *dumpFunctionConfiguration(const FunctionProperties& func);
+
 private:
 	void metadata_path_for_function(const char *funcname, char *path) {
 		sprintf(path, "%s/%s.metadata.json", this->metadata_base_dir.c_str(), funcname);
@@ -6,8 +6,15 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
 #include <pthread.h>
 #include <mutex>
+#include <string>
+#include <chrono>
+#include <future>
+#include <vector>
 #include <unordered_map>
 
 #ifdef __cplusplus
@@ -22,9 +29,12 @@ extern "C" {
 
 
 #include <src/constants.h>
+#include <src/local_trigger.h>
+#include <src/invocation_envelope.h>
 #include <3rdparty/base64.h>
 #include <lib/utility.h>
 #include <lib/wp.h>
+#include <lib/jsonscan.h>
 #include <lib/sha256_util.hpp>
 
 extern "C" {
@@ -144,8 +154,11 @@ int callback_function_create (const struct _u_request * httprequest, struct _u_r
 		fprintf(stdout, "now adding the function to the function table\n");
 		funcMgr->addFunction(func);
 
+		// install it now rather than on the first invocation, the response reports it as Pending
+		funcMgr->installFunctionAsync(func);
+
 		json_decref(req_json);
-		json_t *dump = func->dumpJson();
+		json_t *dump = funcMgr->dumpFunctionConfiguration(*func);
 		const char *func_dump_str = json_dumps(dump, 0);
 		if (func_dump_str == NULL) {
 			json_decref(dump);
@@ -191,8 +204,8 @@ int callback_update_function_code(const struct _u_request * httprequest, struct
 			throw AWSError(404, "ResourceNotFoundException");
 		}
 		
-		const FunctionProperties &origFunc = *(funcMgr->getFunction(funcname));
-		std::shared_ptr<FunctionProperties> func = std::make_shared<FunctionProperties>(origFunc);
+		std::shared_ptr<const FunctionProperties> origFunc = funcMgr->getDeployedFunction(funcname);
+		std::shared_ptr<FunctionProperties> func = std::make_shared<FunctionProperties>(*origFunc);
 
 		// decode the zip file
 		fprintf(stdout, "decoding the source zip file and writing it to disk\n");
@@ -221,9 +234,12 @@ int callback_update_function_code(const struct _u_request * httprequest, struct
 		fprintf(stdout, "now adding the function to the table\n");
 		funcMgr->addFunction(func);
 
+		// invocations that arrive before the install is done wait for it rather than starting another
+		funcMgr->installFunctionAsync(func);
+
 		// dump the function and set it as the result string
 		json_decref(req_json);
-		json_t *dump = func->dumpJson();
+		json_t *dump = funcMgr->dumpFunctionConfiguration(*func);
 		const char *func_dump_str = json_dumps(dump, 0);
 		if (func_dump_str == NULL) {
 			json_decref(dump);
@@ -244,6 +260,43 @@ int callback_update_function_code(const struct _u_request * httprequest, struct
 	}
 }
 
+int callback_function_get(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
+	fprintf(stdout, "\n\nGET REQUEST: callback_function_get\n");
+
+	try {
+		const char *funcname = u_map_get(httprequest->map_url, "name");
+		if (funcname == NULL || !FunctionProperties::validateFunctionName(funcname)) {
+			fprintf(stderr, "Fatal error: bad function name\n");
+			throw AWSError(400, "InvalidParameterValueException");
+		}
+
+		if (!funcMgr->functionExists(funcname)) {
+			fprintf(stderr, "Fatal error: no such function\n");
+			throw AWSError(404, "ResourceNotFoundException");
+		}
+
+		funcMgr->retryPendingInstall(funcname);
+		std::shared_ptr<const FunctionProperties> func = funcMgr->getDeployedFunction(funcname);
+
+		// the shape of the GetFunction response, without the code location
+		json_t *response = json_object();
+		json_object_set_new(response, "Configuration", funcMgr->dumpFunctionConfiguration(*func));
+		const char *response_str = json_dumps(response, 0);
+		json_decref(response);
+		if (response_str == NULL) {
+			throw AWSError(500, "failed to stringify the function configuration");
+		}
+
+		ulfius_set_string_body_response(httpresponse, 200, response_str);
+		free((void *)response_str);
+		return U_CALLBACK_CONTINUE;
+	} catch (const AWSError &e) {
+		fprintf(stderr, "Caught error: %s\n", e.msg.c_str());
+		ulfius_set_string_body_response(httpresponse, e.error_code, e.msg.c_str());
+		return U_CALLBACK_CONTINUE;
+	}
+}
+
 int callback_function_delete(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
 	fprintf(stdout, "\n\nDELETE REQUEST: callback_function_delete\n");
 	json_t* req_json = json_loadb((const char *)httprequest->binary_body, httprequest->binary_body_length, 0, NULL);
@@ -283,164 +336,125 @@ int callback_function_delete(const struct _u_request * httprequest, struct _u_re
 }
 
 /*
-	API request handler for callback_function_invoke
+	invokes the function with payload (a json document), the part of an invocation shared by the
+	http api and the local trigger socket. Returns the result of the function if request_response 
+	is set. throws AWSError
 */
-int callback_function_invoke (const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
-	fprintf(stdout, "\n\nPOST REQUEST: callback_function_invoke\n");
-	
-	json_t* req_json = json_loadb((char *)httprequest->binary_body, httprequest->binary_body_length, 0, NULL);
-
-	const char *funcname;
-	std::shared_ptr<const FunctionProperties> func = nullptr;
-	bool request_response = false;
-
-	try {
-		if (!req_json) {
-			throw AWSError(400, "InvalidRequestContentException");
-		}
-
-		funcname = u_map_get(httprequest->map_url, "name");
-		fprintf(stdout, "invoking function: %s\n", funcname);
-		if (!FunctionProperties::validateFunctionName(funcname)) {
-			fprintf(stderr, "Fatal error: bad function name\n");
-			throw AWSError(400, "InvalidParameterValueException");
-		}
-
-
-		if (!funcMgr->functionExists(funcname)) {
-			fprintf(stderr, "Fatal error: no such function\n");
-			throw AWSError(404, "ResourceNotFoundException");
-		}
+std::string invoke_function(const char *funcname, const char *payload, size_t payload_len, bool request_response) {
+	fprintf(stdout, "invoking function: %s\n", funcname);
+	if (!FunctionProperties::validateFunctionName(funcname)) {
+		fprintf(stderr, "Fatal error: bad function name\n");
+		throw AWSError(400, "InvalidParameterValueException");
+	}
 
-		// generate resultwoof if needed
-		const char *invocation_type = u_map_get(httprequest->map_header, "X-Amz-Invocation-Type") ;
-		if (!invocation_type) 
-			invocation_type = "RequestResponse";
-		
-		request_response = strcmp(invocation_type, "RequestResponse") == 0;
+	if (!funcMgr->functionExists(funcname)) {
+		fprintf(stderr, "Fatal error: no such function\n");
+		throw AWSError(404, "ResourceNotFoundException");
+	}
 
+	std::shared_ptr<const FunctionProperties> func;
+	do {
 		fprintf(stdout, "getting function object for function %s\n", funcname);
+		funcMgr->retryPendingInstall(funcname);
 		func = funcMgr->getFunction(funcname);
 		fprintf(stdout, "installing function if not already installed %s\n", funcname);
 		if (!func->isInstalled()) {
 			fprintf(stdout, "\tfunction not installed, installing\n");
 			funcMgr->installFunction(func);
-			func = funcMgr->getFunction(funcname);
 		}
-
-	} catch (const AWSError &e) {
-		fprintf(stderr, "Caught error: %s\n", e.msg.c_str());
-		json_decref(req_json);
-		ulfius_set_string_body_response(httpresponse, e.error_code, e.msg.c_str());
-		return U_CALLBACK_CONTINUE;
-	}
+		// the installation was replaced and closed by the reaper since we looked it up
+	} while (!func->installation->enter());
 
 	std::shared_ptr<FunctionInstallation> installation = func->installation;
+	InstallationInvocation running(installation.get()); // keeps it from being reaped until we return
 	WP *wp = installation->wp;
-	struct ResultWooF resultwoof;
+	
+	// the result is routed to us by correlation id, see FunctionInstallation::routeResults
+	uint64_t correlation_id = 0;
+	std::future<std::string> result;
 
 	try {
 		if (request_response) {
-			queue_get(&(installation->result_woof_queue), &resultwoof);
-			
-			WPJob* theJob = create_job_easy(wp, wpcmd_woofgetlatestseqno);
-			struct wpcmd_woofgetlatestseqno_arg *arg = 
-				(struct wpcmd_woofgetlatestseqno_arg *)(theJob->arg = bp_getchunk(funcMgr->bp_jobobject_pool));
-			strcpy(arg->woofname, resultwoof.woofname);
-			int retval = wp_job_invoke(wp, theJob);
-			bp_freechunk(funcMgr->bp_jobobject_pool, (void *)arg);
-			if (retval < 0) {
-				fprintf(stderr, "Fatal error: failed to get the seqno from the namespace\n");
-				throw AWSError(500, "ServiceException");
-			}
-
-			resultwoof.seqno = retval;
+			result = installation->results.expect(&correlation_id);
 		}
 
 		fprintf(stdout, "function invocation options:\n"
 			"\tfunction name: %s\n"
 			"\tfunction dir: %s\n"
-			"\tresult woof: %s (seqno: %d)\n"
+			"\tcorrelation id: %llu\n"
 			"\trequest response: %d\n",
 			funcname, installation->install_path.c_str(), 
-			request_response ? resultwoof.woofname : NULL, 
-			request_response ? resultwoof.seqno : -1, 
+			(unsigned long long)correlation_id,
 			request_response);
 		
-		// compose the payload to put in the WooF, first build the metadata objects and the 
-		// payload string as provided by the client
-		char *woofputbuffer = NULL;
+		// compose the element to put in the WooF, an envelope followed by the payload string as 
+		// provided by the client (see src/invocation_envelope.h). It is written straight into the
+		// shared chunk that is handed to the worker process
+		char *element = NULL;
+		std::string blob_path;
 		{
-			json_t *metadata = json_object();
-			json_object_set_new(metadata, "function", json_string(funcname));
-			if (request_response) {
-				json_object_set_new(metadata, "result_woof", json_string(resultwoof.woofname));
-			} else {
-				json_object_set_new(metadata, "result_woof", json_null());
-			}
-			json_object_set_new(metadata, "metadata", func->dumpJson());
-
-			const char *payload_str = json_dumps(req_json, JSON_COMPACT);
-			json_decref(req_json);
-			const char *metadata_str = json_dumps(metadata, JSON_COMPACT);
-			json_decref(metadata);
-
-			if (payload_str == NULL) {
-				free((void *)payload_str);
-				throw AWSError(500, "ServiceException");
+			size_t envelope_len = sizeof(struct InvocationEnvelope);
+			if (payload_len > INVOCATION_MAX_PAYLOAD_SIZE) {
+				throw AWSError(413, "RequestTooLargeException");
 			}
-
-			if (metadata_str == NULL) {
-				free((void *)payload_str);
-				fprintf(stderr, "Fatal error: failed to dump the payload_str as JSON\n");
-				throw AWSError(500, "ServiceException");
+			if (strlen(funcname) >= INVOCATION_FUNCTION_NAME_MAX || 
+				func->src_zip_sha256.length() >= sizeof(((struct InvocationEnvelope *)0)->code_sha256)) {
+				throw AWSError(400, "InvalidParameterValueException");
 			}
 
-			int payload_str_len = strlen(payload_str);
-			int metadata_str_len = strlen(metadata_str);
-			if (payload_str_len + metadata_str_len + 2 > CALL_WOOF_EL_SIZE) {
-				// the request was too large to fit in the buffer
-				free((void *)payload_str);
-				free((void *)metadata_str);
-				throw AWSError(500, "ServiceException");
+			// a payload that does not fit inline is spilled into a file and the element carries its 
+			// name instead
+			uint16_t flags = request_response ? INVOCATION_FLAG_REQUEST_RESPONSE : 0;
+			uint32_t blob_length = 0;
+			char blob_name[64];
+			if (envelope_len + payload_len + 1 > CALL_WOOF_EL_SIZE) {
+				snprintf(blob_name, sizeof(blob_name), INVOCATION_BLOB_DIR "/%llu.payload", 
+					(unsigned long long)installation->next_blob_id++);
+				blob_path = installation->install_path + "/" + blob_name;
+				if (invocation_blob_write(blob_path.c_str(), payload, payload_len) != 0) {
+					fprintf(stderr, "Fatal error: failed to write the payload to %s\n", blob_path.c_str());
+					unlink(blob_path.c_str());
+					throw AWSError(500, "ServiceException");
+				}
+				flags |= INVOCATION_FLAG_PAYLOAD_BLOB;
+				blob_length = payload_len;
+				payload = blob_name;
+				payload_len = strlen(blob_name);
 			}
 
-			woofputbuffer = (char *)malloc(CALL_WOOF_EL_SIZE); 
-			if (woofputbuffer == NULL) {
-				free((void *)payload_str);
-				free((void *)metadata_str);
-				throw AWSError(500, "ServiceException");
-			}
-
-			// should now look like metadata \0 payload \0 
-			memset(woofputbuffer, 0, CALL_WOOF_EL_SIZE);
-			strncpy(woofputbuffer, metadata_str, metadata_str_len);
-			strncpy(woofputbuffer + metadata_str_len + 1, payload_str, payload_str_len);
-			
-			free((void *)payload_str);
-			free((void *)metadata_str);
+			element = (char *)bp_getchunk(funcMgr->bp_job_bigstringpool);
+
+			// the rest is zeroed so that nothing from a previous invocation ends up in the woof
+			struct InvocationEnvelope *envelope = (struct InvocationEnvelope *)element;
+			memset(envelope, 0, envelope_len);
+			envelope->magic = INVOCATION_ENVELOPE_MAGIC;
+			envelope->version = INVOCATION_ENVELOPE_VERSION;
+			envelope->flags = flags;
+			envelope->correlation_id = correlation_id;
+			strcpy(envelope->code_sha256, func->src_zip_sha256.c_str());
+			strcpy(envelope->function_name, funcname);
+			envelope->payload_offset = envelope_len;
+			envelope->payload_length = payload_len;
+			envelope->blob_length = blob_length;
+			memcpy(element + envelope_len, payload, payload_len);
+			memset(element + envelope_len + payload_len, 0, CALL_WOOF_EL_SIZE - (envelope_len + payload_len));
 		}
 
 		fprintf(stdout, "successfully constructed the payload for the WooFPut\n");
 
-		// Do the WooF Put that invokes the lambda function
+		// Do the WooF Put that invokes the lambda function, this is the only round trip into the 
+		// worker process, the result comes back through installation->results
 		{
-			WPJob* theJob = create_job_easy(wp, wpcmd_woofput);
-			struct wpcmd_woofput_arg *arg = 
-				(struct wpcmd_woofput_arg *)(theJob->arg = bp_getchunk(funcMgr->bp_jobobject_pool));
-			strcpy(arg->woofname, CALL_WOOF_NAME); // set the woofname
-			strcpy(arg->handlername, "awspy_lambda"); // set the handlername
-			char *sharedbuff = (char *)bp_getchunk(funcMgr->bp_job_bigstringpool);
-			arg->payload = sharedbuff; // set the payload
-			memcpy(sharedbuff, woofputbuffer, CALL_WOOF_EL_SIZE);
-			free(woofputbuffer);
+			WPJob* theJob = create_job_easy(wp, wpcmd_invoke);
+			theJob->arg = element;
 			
-			fprintf(stdout, "Invoking WooFPut command\n");
+			fprintf(stdout, "Invoking invoke command\n");
 			int retval = wp_job_invoke(wp, theJob);
 
-			bp_freechunk(funcMgr->bp_jobobject_pool, (void *)arg);
-			bp_freechunk(funcMgr->bp_job_bigstringpool, (void *)sharedbuff);
+			bp_freechunk(funcMgr->bp_job_bigstringpool, (void *)element);
 			if (retval < 0) {
+				if (!blob_path.empty())
+					unlink(blob_path.c_str());
 				fprintf(stderr, "Fatal error: failed to put the invocation in WooF '%s'\n", CALL_WOOF_NAME);
 				throw AWSError(500, "ServiceException");
 			}
@@ -449,51 +463,158 @@ int callback_function_invoke (const struct _u_request * httprequest, struct _u_r
 		}
 		
 		if (request_response) {
-			fprintf(stdout, "Result Woof was defined, so we are spinning until the result is available\n");
-
-			WPJob* theJob = create_job_easy(wp, wpcmd_waitforresult);
-			struct wpcmd_waitforresult_arg *arg = 
-				(struct wpcmd_waitforresult_arg *)(theJob->arg = bp_getchunk(funcMgr->bp_jobobject_pool));
-			char *result = (char *)(theJob->result = bp_getchunk(funcMgr->bp_job_bigstringpool));
-			arg->timeout = 30000L;
-			memcpy(&(arg->resultwoof), &resultwoof, sizeof(struct ResultWooF));
-			
-			int retval = wp_job_invoke(wp, theJob);
-			bp_freechunk(funcMgr->bp_jobobject_pool, (void *)arg);
-			
-			if (retval < 0) {
-				if (request_response)
-					queue_put(&(installation->result_woof_queue), &resultwoof);
-				
-				bp_freechunk(funcMgr->bp_job_bigstringpool, (void *)result);
+			fprintf(stdout, "waiting for the result of invocation %llu\n", (unsigned long long)correlation_id);
+
+			if (result.wait_for(std::chrono::milliseconds(RESULT_TIMEOUT_MS)) != std::future_status::ready) {
+				installation->results.abandon(correlation_id);
 				fprintf(stderr, "Fatal error: failed to get result from lambda invocation, timed out or other error encountered\n");
-				ulfius_set_string_body_response(httpresponse, 200, "{\"error\": \"function timed out\"}"); // TODO: improve this message to make it match that which you would get from AWS
-				return U_CALLBACK_CONTINUE;
+				return "{\"error\": \"function timed out\"}"; // TODO: improve this message to make it match that which you would get from AWS
 			}
 
 			fprintf(stdout, "finished waiting for the result\n");
-			resultwoof.seqno = retval;
-			queue_put(&(installation->result_woof_queue), &resultwoof);
-
-			ulfius_set_string_body_response(httpresponse, 200, result);
-			bp_freechunk(funcMgr->bp_job_bigstringpool, (void *)result);
-			return U_CALLBACK_CONTINUE;
+			return result.get();
 		}
 		
-		ulfius_set_string_body_response(httpresponse, 200, "{\"status\": \"ok\"}");
-		return U_CALLBACK_CONTINUE;
+		return "{\"status\": \"ok\"}";
 
 	} catch (const AWSError &e) {
-		fprintf(stderr, "Caught error: %s\n", e.msg.c_str());
 		if (request_response) 
-			queue_put(&(installation->result_woof_queue), &resultwoof);
-		
-		json_decref(req_json);
+			installation->results.abandon(correlation_id);
+		throw;
+	}
+}
+
+/*
+	API request handler for callback_function_invoke
+*/
+int callback_function_invoke (const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
+	fprintf(stdout, "\n\nPOST REQUEST: callback_function_invoke\n");
+	
+	// the body is only checked, it is passed along as is and copied once into the woof element
+	const char *payload = (const char *)httprequest->binary_body;
+	size_t payload_len = httprequest->binary_body_length;
+
+	try {
+		if (payload == NULL || jsonscan_validate(payload, payload_len) != 0) {
+			throw AWSError(400, "InvalidRequestContentException");
+		}
+
+		const char *funcname = u_map_get(httprequest->map_url, "name");
+
+		// generate resultwoof if needed
+		const char *invocation_type = u_map_get(httprequest->map_header, "X-Amz-Invocation-Type") ;
+		if (!invocation_type) 
+			invocation_type = "RequestResponse";
+		bool request_response = strcmp(invocation_type, "RequestResponse") == 0;
+
+		std::string result = invoke_function(funcname, payload, payload_len, request_response);
+
+		ulfius_set_string_body_response(httpresponse, 200, result.c_str());
+		return U_CALLBACK_CONTINUE;
+	} catch (const AWSError &e) {
+		fprintf(stderr, "Caught error: %s\n", e.msg.c_str());
 		ulfius_set_string_body_response(httpresponse, e.error_code, e.msg.c_str());
 		return U_CALLBACK_CONTINUE;
 	}
 }
 
+/*
+	local trigger socket, lets a bridge running on the same host (the s3_client) invoke functions
+	without going through http. Invocations arrive as frames in the format described in
+	src/local_trigger.h and are always asynchronous (the Event invocation type).
+*/
+void *local_trigger_connection(void *arg) {
+	int fd = (int)(intptr_t)arg;
+	std::vector<char> buffer;
+
+	struct LocalTriggerHeader header;
+	while (local_trigger_read_full(fd, &header, sizeof(header)) == 0) {
+		struct LocalTriggerAck ack;
+		ack.magic = LOCAL_TRIGGER_MAGIC;
+		ack.status = 200;
+
+		if (header.magic != LOCAL_TRIGGER_MAGIC || header.function_name_length >= LOCAL_TRIGGER_MAX_NAME ||
+			header.payload_length > INVOCATION_MAX_PAYLOAD_SIZE) {
+			fprintf(stderr, "local trigger: malformed frame, closing the connection\n");
+			break;
+		}
+
+		// function name \0 payload \0
+		buffer.resize(header.function_name_length + header.payload_length + 2);
+		char *funcname = buffer.data();
+		char *payload = funcname + header.function_name_length + 1;
+		if (local_trigger_read_full(fd, funcname, header.function_name_length) != 0 ||
+			local_trigger_read_full(fd, payload, header.payload_length) != 0)
+			break;
+		funcname[header.function_name_length] = '\0';
+		payload[header.payload_length] = '\0';
+
+		fprintf(stdout, "\n\nLOCAL TRIGGER: invoke %s\n", funcname);
+		try {
+			if (jsonscan_validate(payload, header.payload_length) != 0)
+				throw AWSError(400, "InvalidRequestContentException");
+			invoke_function(funcname, payload, header.payload_length, false);
+		} catch (const AWSError &e) {
+			fprintf(stderr, "Caught error: %s\n", e.msg.c_str());
+			ack.status = e.error_code;
+		}
+
+		if (local_trigger_write_full(fd, &ack, sizeof(ack)) != 0)
+			break;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+void *local_trigger_listen(void *arg) {
+	int listenfd = (int)(intptr_t)arg;
+	while (true) {
+		int fd = accept(listenfd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "local trigger: accept failed, no longer accepting local invocations\n");
+			return NULL;
+		}
+
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, local_trigger_connection, (void *)(intptr_t)fd) != 0) {
+			fprintf(stderr, "local trigger: failed to create a thread for the connection\n");
+			close(fd);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+}
+
+int start_local_trigger() {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, LAMBDA_LOCAL_TRIGGER_SOCKET, sizeof(addr.sun_path) - 1);
+
+	int listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listenfd < 0)
+		return -1;
+
+	// a socket left behind by a previous run would make the bind fail
+	unlink(LAMBDA_LOCAL_TRIGGER_SOCKET);
+	if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenfd, 16) != 0) {
+		close(listenfd);
+		return -1;
+	}
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, local_trigger_listen, (void *)(intptr_t)listenfd) != 0) {
+		close(listenfd);
+		unlink(LAMBDA_LOCAL_TRIGGER_SOCKET);
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
+
 void sig_handler(int sig) {
 	switch (sig) {
 	case SIGINT:
@@ -513,10 +634,6 @@ int main(int argc, char **argv)
 	*/
 	struct _u_instance instance;
 	
-	funcMgr = new FunctionManager;
-	funcMgr->install_base_dir = "./functions/installs";
-	funcMgr->metadata_base_dir = "./functions/metadata";
-
 	// Setup the functions directory
 	struct stat st = {0};
 	if (stat("./functions", &st) == -1) {
@@ -527,6 +644,8 @@ int main(int argc, char **argv)
 		mkdir("./functions/zips", 0700);
 	}
 
+	funcMgr = new FunctionManager("./functions/installs", "./functions/metadata");
+
 	// Initialize instance with the port number
 	if (ulfius_init_instance(&instance, PORT, NULL, NULL) != U_OK) {
 		fprintf(stderr, "Error ulfius_init_instance, abort\n");
@@ -536,8 +655,14 @@ int main(int argc, char **argv)
 	ulfius_add_endpoint_by_val(&instance, "POST", "/2015-03-31/", "/functions", 0, &callback_function_create, NULL);
 	ulfius_add_endpoint_by_val(&instance, "POST", "/2015-03-31/", "/functions/:name/invocations", 0, &callback_function_invoke, NULL);
 	ulfius_add_endpoint_by_val(&instance, "PUT", "/2015-03-31/", "/functions/:name/code", 0, &callback_update_function_code, NULL);
+	ulfius_add_endpoint_by_val(&instance, "GET", "/2015-03-31/", "/functions/:name", 0, &callback_function_get, NULL);
 	ulfius_add_endpoint_by_val(&instance, "DELETE", "/2015-03-31/", "/functions/:name", 0, &callback_function_delete, NULL);
 
+	// bridges on the same host can skip http and invoke functions through the socket
+	if (start_local_trigger() != 0) {
+		fprintf(stderr, "failed to listen on %s, local invocations are disabled\n", LAMBDA_LOCAL_TRIGGER_SOCKET);
+	}
+
 	// Start the framework
 	signal(SIGINT, sig_handler);
 
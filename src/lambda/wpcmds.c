@@ -1,6 +1,10 @@
 #include <unistd.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <lib/wp.h>
+#include <src/constants.h>
 
 #include "wpcmds.h"
 
@@ -11,6 +15,15 @@
 /*
 	Worker process commands etc
 */
+
+#define RESULT_WAIT_POLL_MS 4L // how often to check for a result when there is no fifo to wait on
+#define RESULT_WAIT_FALLBACK_MS 50L // how often to check anyway, in case a wakeup is missed
+
+static long elapsed_ms(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000L + (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
 extern int wpcmd_initdir(WP *wp, WPJob* job) {
 	struct wpcmd_initdir_arg *arg = job->arg;
 	fprintf(stdout, "Child process: chdir('%s')\n", arg->dir);
@@ -43,21 +56,64 @@ extern int wpcmd_waitforresult(WP *wp, WPJob *job) {
 	
 	int seqno = 0;
 	int startseqno = arg->resultwoof.seqno;
+	arg->lost_from = 0;
+	arg->lost_to = 0;
 	long timeout = arg->timeout; // 30 seconds
-	long sleep_time = 4L;
 
-	while (timeout > 0 && (seqno = WooFGetLatestSeqno(arg->resultwoof.woofname)) == startseqno ) {
-		if (nanosleep((const struct timespec[]){{0, sleep_time * 1000000L}}, NULL) != 0) {
-			break ;
+	// opened read-write so that the open does not wait for a writer and the fifo never reads
+	// as closed. Without it we fall back to polling.
+	char notifypath[PATH_MAX];
+	snprintf(notifypath, sizeof(notifypath), "%s" RESULT_WOOF_NOTIFY_SUFFIX, arg->resultwoof.woofname);
+	int notifyfd = open(notifypath, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (1) {
+		// drain the wakeups before checking, one that arrives after the check ends the next wait
+		char drain[64];
+		while (notifyfd >= 0 && read(notifyfd, drain, sizeof(drain)) > 0)
+			;
+
+		if ((seqno = WooFGetLatestSeqno(arg->resultwoof.woofname)) > startseqno || WooFInvalid(seqno))
+			break;
+
+		long remaining = timeout - elapsed_ms(&start);
+		if (remaining <= 0)
+			break;
+
+		if (notifyfd >= 0) {
+			struct pollfd pfd = { notifyfd, POLLIN, 0 };
+			poll(&pfd, 1, remaining < RESULT_WAIT_FALLBACK_MS ? remaining : RESULT_WAIT_FALLBACK_MS);
+		} else {
+			long sleep_time = remaining < RESULT_WAIT_POLL_MS ? remaining : RESULT_WAIT_POLL_MS;
+			nanosleep((const struct timespec[]){{0, sleep_time * 1000000L}}, NULL);
 		}
-		timeout -= sleep_time;
 	}
 
-	if (timeout < 0 || seqno == startseqno)
+	if (notifyfd >= 0)
+		close(notifyfd);
+
+	if (WooFInvalid(seqno))
+		return -2;
+	if (seqno <= startseqno)
 		return -1;
 
-	WooFGet(arg->resultwoof.woofname, resultbuffer, seqno);
-	return seqno;
+	int next = startseqno + 1;
+	if (seqno - next >= RESULT_WOOF_QUEUE_DEPTH) {
+		arg->lost_from = next;
+		arg->lost_to = seqno - RESULT_WOOF_QUEUE_DEPTH;
+		fprintf(stderr, "Child process: results %d to %d were overwritten before they were read\n",
+			arg->lost_from, arg->lost_to);
+		next = seqno - RESULT_WOOF_QUEUE_DEPTH + 1;
+	}
+
+	if (WooFGet(arg->resultwoof.woofname, resultbuffer, next) < 0)
+		return -2;
+	return next;
+}
+
+extern int wpcmd_invoke(WP *wp, WPJob *job) {
+	return WooFPut(CALL_WOOF_NAME, CALL_WOOF_HANDLER, job->arg);
 }
 
 extern int wpcmd_woofgetlatestseqno(WP *wp, WPJob *job) {
@@ -71,5 +127,6 @@ WPHandler wphandler_array[] = {
 	wpcmd_woofput, 
 	wpcmd_waitforresult,
 	wpcmd_woofgetlatestseqno,
+	wpcmd_invoke,
 	0
 };
\ No newline at end of file
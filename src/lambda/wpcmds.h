@@ -38,13 +38,24 @@ struct wpcmd_woofput_arg {
 
 extern int wpcmd_woofput(WP *wp, WPJob* job);
 
+// waits for the element after resultwoof.seqno to be put and copies it into the result buffer,
+// returns its seqno, -1 on timeout or -2 if the woof could not be read. If the waiter fell so far
+// behind that the element was overwritten it skips to the oldest element still in the woof and
+// reports the seqnos it skipped in lost_from to lost_to, both are 0 if nothing was skipped.
 struct wpcmd_waitforresult_arg {
 	struct ResultWooF resultwoof;
 	long timeout;
+	int lost_from; // set by the command
+	int lost_to;
 }; // no result struct, the result is just a buffer
 
 extern int wpcmd_waitforresult(WP *wp, WPJob *job);
 
+// puts an invocation of the function in CALL_WOOF_NAME. The arg is the woof element itself (it is
+// not in the union below), composed in a chunk of bp_job_bigstringpool, so that an invocation
+// takes a single chunk and a single command.
+extern int wpcmd_invoke(WP *wp, WPJob *job);
+
 struct wpcmd_woofgetlatestseqno_arg {
 	char woofname[PATH_MAX];
 };
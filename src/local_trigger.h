@@ -0,0 +1,65 @@
+#ifndef __LOCAL_TRIGGER_H
+#define __LOCAL_TRIGGER_H
+
+/*
+	the local trigger socket lets a bridge running on the same host as the lambda_client invoke
+	functions without http. A client sends frames on a unix stream socket:
+
+		struct LocalTriggerHeader | function name (no terminator) | payload (json)
+
+	and gets one struct LocalTriggerAck back per frame once the invocation has been queued. A
+	connection may be used for any number of frames.
+*/
+
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define LOCAL_TRIGGER_MAGIC 0x4c54524eu
+#define LOCAL_TRIGGER_MAX_NAME 256
+#define LOCAL_TRIGGER_TIMEOUT_S 30 // the same as the http path, for sending a frame and for its ack
+
+struct LocalTriggerHeader {
+	uint32_t magic;
+	uint32_t function_name_length;
+	uint32_t payload_length;
+	uint32_t flags; // reserved, must be 0
+};
+
+struct LocalTriggerAck {
+	uint32_t magic;
+	int32_t status; // an http status code, 200 if the invocation was queued
+};
+
+// read and write exactly len bytes, return -1 if the connection failed or was closed
+static inline int local_trigger_read_full(int fd, void *buffer, size_t len) {
+	char *pos = (char *)buffer;
+	while (len > 0) {
+		ssize_t n = read(fd, pos, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		pos += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static inline int local_trigger_write_full(int fd, const void *buffer, size_t len) {
+	const char *pos = (const char *)buffer;
+	while (len > 0) {
+		ssize_t n = send(fd, pos, len, MSG_NOSIGNAL); // a closed peer is an error, not a SIGPIPE
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		pos += n;
+		len -= n;
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef LOCAL_TRIGGER_CLIENT_HPP
+#define LOCAL_TRIGGER_CLIENT_HPP
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <src/local_trigger.h>
+
+// invokes functions through the lambda_client's local trigger socket. Connections are kept open
+// and reused, one per concurrent caller.
+class LocalTriggerClient {
+	std::mutex lock;
+	std::vector<int> idle;
+	std::string socketPath;
+
+	int connectSocket() {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, this->socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+		int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return -1;
+		// a stalled lambda_client must not hold up a dispatcher thread forever
+		struct timeval timeout = { LOCAL_TRIGGER_TIMEOUT_S, 0 };
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ||
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0 ||
+			connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+public:
+	LocalTriggerClient(const std::string& socketPath) : socketPath(socketPath) {
+	}
+
+	~LocalTriggerClient() {
+		for (int fd : this->idle) {
+			close(fd);
+		}
+	}
+
+	constexpr static long NOT_SENT = -1; // the frame was not sent, the caller should fall back to http
+	constexpr static long ACK_LOST = -2; // the frame was sent but no ack came back, it may have been queued
+
+	// queues an asynchronous invocation, returns the status the lambda_client answered with, 
+	// NOT_SENT or ACK_LOST
+	long invoke(const std::string& functionName, const std::string& payload) {
+		int fd = -1;
+		{
+			std::lock_guard<std::mutex> g(this->lock);
+			if (!this->idle.empty()) {
+				fd = this->idle.back();
+				this->idle.pop_back();
+			}
+		}
+		if (fd < 0 && (fd = this->connectSocket()) < 0)
+			return NOT_SENT;
+
+		struct LocalTriggerHeader header;
+		header.magic = LOCAL_TRIGGER_MAGIC;
+		header.function_name_length = functionName.length();
+		header.payload_length = payload.length();
+		header.flags = 0;
+
+		if (local_trigger_write_full(fd, &header, sizeof(header)) != 0 ||
+			local_trigger_write_full(fd, functionName.c_str(), functionName.length()) != 0 ||
+			local_trigger_write_full(fd, payload.c_str(), payload.length()) != 0) {
+			// the lambda_client went away (or the connection is otherwise broken), an incomplete
+			// frame is never queued
+			close(fd);
+			return NOT_SENT;
+		}
+
+		struct LocalTriggerAck ack;
+		if (local_trigger_read_full(fd, &ack, sizeof(ack)) != 0 || ack.magic != LOCAL_TRIGGER_MAGIC) {
+			close(fd);
+			return ACK_LOST;
+		}
+
+		std::lock_guard<std::mutex> g(this->lock);
+		this->idle.push_back(fd);
+		return ack.status;
+	}
+};
+
+#endif
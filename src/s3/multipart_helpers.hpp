@@ -0,0 +1,114 @@
+#ifndef MULTIPART_HELPERS_HPP
+#define MULTIPART_HELPERS_HPP
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define MAX_MULTIPART_PART_NUMBER (10000)
+
+// an upload that has been started with CreateMultipartUpload but not yet completed or aborted.
+// parts are written straight into the shard logs as they arrive, completing the upload only
+// writes a manifest that refers to the chains the parts were written to.
+struct S3MultipartUpload {
+	struct Part {
+		S3LogRef ref;
+		uint64_t size = 0;
+		std::string etag;
+	};
+
+	std::string uploadId;
+	std::string bucket_name;
+	std::string key;
+
+	// guards parts and closed, the parts of an upload are expected to arrive in parallel
+	std::mutex lock;
+	std::map<int, Part> parts; // ordered by part number
+	// set while a complete or abort owns the parts, nothing else may touch them until then
+	bool closed = false;
+
+	// re-uploading a part number replaces the previous upload of that part, returns true if 
+	// there was one (it is copied into replaced). Throws NoSuchUpload once the upload is closed.
+	bool putPart(int partNumber, const Part& part, Part& replaced) {
+		std::lock_guard<std::mutex> g(this->lock);
+		if (this->closed) {
+			throw AWSError(404, "NoSuchUpload");
+		}
+		auto existing = this->parts.find(partNumber);
+		bool hadPart = existing != this->parts.end();
+		if (hadPart) {
+			replaced = existing->second;
+		}
+		this->parts[partNumber] = part;
+		return hadPart;
+	}
+
+	// closes the upload and hands every part to the caller, who is then the only one that can
+	// reference or discard them. Only one complete or abort wins, the others get NoSuchUpload.
+	std::map<int, Part> close() {
+		std::lock_guard<std::mutex> g(this->lock);
+		if (this->closed) {
+			throw AWSError(404, "NoSuchUpload");
+		}
+		this->closed = true;
+		std::map<int, Part> taken;
+		taken.swap(this->parts);
+		return taken;
+	}
+
+	// gives the parts back after a complete that was rejected, the upload can be used again
+	void reopen(std::map<int, Part>& taken) {
+		std::lock_guard<std::mutex> g(this->lock);
+		this->parts.swap(taken);
+		this->closed = false;
+	}
+};
+
+class S3MultipartUploadTable {
+	std::mutex lock;
+	std::unordered_map<std::string, std::shared_ptr<S3MultipartUpload>> uploads;
+
+	std::random_device rd;
+	std::default_random_engine generator = std::default_random_engine(rd());
+
+public:
+	std::shared_ptr<S3MultipartUpload> create(const std::string& bucket_name, const std::string& key) {
+		std::shared_ptr<S3MultipartUpload> upload = std::make_shared<S3MultipartUpload>();
+		upload->bucket_name = bucket_name;
+		upload->key = key;
+
+		std::lock_guard<std::mutex> g(this->lock);
+		std::uniform_int_distribution<long long unsigned> distribution(0,0xFFFFFFFFFFFFFFFF);
+		do {
+			char buffer[64];
+			snprintf(buffer, sizeof(buffer) - 1, "%016llx%016llx", distribution(generator), distribution(generator));
+			upload->uploadId = buffer;
+		} while (this->uploads.find(upload->uploadId) != this->uploads.end());
+
+		this->uploads[upload->uploadId] = upload;
+		return upload;
+	}
+
+	// throws AWSError if there is no such upload in progress for the bucket and key
+	std::shared_ptr<S3MultipartUpload> get(const char *uploadId, const std::string& bucket_name, const std::string& key) {
+		std::lock_guard<std::mutex> g(this->lock);
+		auto upload = this->uploads.find(uploadId);
+		if (upload == this->uploads.end() ||
+			upload->second->bucket_name != bucket_name ||
+			upload->second->key != key) {
+			throw AWSError(404, "NoSuchUpload");
+		}
+		return upload->second;
+	}
+
+	void remove(const std::string& uploadId) {
+		std::lock_guard<std::mutex> g(this->lock);
+		this->uploads.erase(uploadId);
+	}
+};
+
+#endif
@@ -4,150 +4,344 @@
 // TODO: put this code in its own namespace
 
 #include <array>
+#include <map>
+#include <memory>
 #include <vector>
 #include <unordered_map>
 #include <string>
 #include <3rdparty/rapidxml/rapidxml.hpp>
+#include <lib/http_pool.hpp>
+
+#include "local_trigger_client.hpp"
 
 using namespace std;
 using namespace rapidxml;
 
-const array<const char *, 4> eventTypes = {
+#define MAX_NOTIFICATION_BATCH_SIZE (1000)
+#define MAX_NOTIFICATION_BATCH_WINDOW_MS (300 * 1000)
+
+const array<const char *, 5> eventTypes = {
 	"s3:ObjectCreated:Put",
 	"s3:ObjectCreated:Post",
 	"s3:ObjectCreated:Copy",
+	"s3:ObjectCreated:CompleteMultipartUpload",
 	"s3:ObjectRemoved:Delete"
 };
 
+// the rules of a configuration are evaluated against a mask with the bit of the event type set
+inline uint32_t eventTypeBit(const std::string& eventName) {
+	for (size_t i = 0; i < eventTypes.size(); ++i) {
+		if (eventName == eventTypes[i])
+			return 1u << i;
+	}
+	return 0;
+}
+
+// matches a name against a pattern where '*' stands for any run of characters
+inline bool globMatch(const char *pattern, const char *name) {
+	const char *star = nullptr; // the last star seen in the pattern
+	const char *resume = nullptr; // where the name picks up if the text after it fails to match
+	while (*name != '\0') {
+		if (*pattern == '*') {
+			star = pattern++;
+			resume = name;
+		} else if (*pattern == *name) {
+			pattern++;
+			name++;
+		} else if (star != nullptr) {
+			pattern = star + 1;
+			name = ++resume;
+		} else {
+			return false;
+		}
+	}
+	while (*pattern == '*')
+		pattern++;
+	return *pattern == '\0';
+}
+
+// the mask of every event type the pattern (e.g. s3:ObjectCreated:*) stands for
+inline uint32_t eventTypeMask(const char *pattern) {
+	uint32_t mask = 0;
+	for (size_t i = 0; i < eventTypes.size(); ++i) {
+		if (globMatch(pattern, eventTypes[i]))
+			mask |= 1u << i;
+	}
+	return mask;
+}
+
+
+// connections to the lambda api are kept open and shared by the dispatcher threads
+inline HttpConnectionPool &lambdaConnectionPool() {
+	static HttpConnectionPool pool(NOTIFICATION_HTTP_CONNECTIONS);
+	return pool;
+}
+
+// when the lambda_client runs on the same host events skip http and are handed over through its
+// local trigger socket
+inline LocalTriggerClient &localTriggerClient() {
+	static LocalTriggerClient client(LAMBDA_LOCAL_TRIGGER_SOCKET);
+	return client;
+}
+
+// invokes the lambda with the event, returns false if it could not be delivered. body is a 
+// complete event document ({"Records": [...]}). Delivery is at least once: a false return may
+// still have queued the invocation, and the caller retries the records.
+inline bool invokeLambdaWithEvent(const std::string &lambdaArn, const std::string &body) {
+	fprintf(stdout, "attempting to invoke lambda '%s'\n", lambdaArn.c_str());
+	const std::string lambdaName = getNameFromLambdaArn(lambdaArn.c_str());
+
+	long status = localTriggerClient().invoke(lambdaName, body);
+	if (status == LocalTriggerClient::ACK_LOST) {
+		// the frame may have been queued, so the retry can run the lambda a second time. Like 
+		// S3 itself, handlers have to tolerate events that are delivered more than once.
+		fprintf(stderr, "No ack from the local trigger for lambda '%s', will retry\n", lambdaArn.c_str());
+		return false;
+	}
+	if (status >= 0) {
+		fprintf(stdout, "LOCAL TRIGGER STATUS: %ld\n", status);
+		if (status < 200 || status >= 300) {
+			fprintf(stderr, "Failed to invoke the handler lambda subscribed to this event\n");
+			return false;
+		}
+		return true;
+	}
 
-class EventFilter {
-public:
-	virtual bool filter(const std::string &eventName, json_t *event) = 0;
+	const std::string url = std::string(LAMBDA_API_ENDPOINT "/2015-03-31/functions/") + 
+		lambdaName + "/invocations";
+	static const std::vector<std::string> headers = {
+		"Content-Type: application/json",
+		"X-Amz-Invocation-Type: Event"
+	};
 
-	virtual ~EventFilter() {
-	}
-};
+	fprintf(stdout, "Making HTTP request to URL %s\n", url.c_str());
+	std::string response;
+	status = lambdaConnectionPool().post(url, headers, body, response, 30);
+	fprintf(stdout, "RESPONSE STATUS: %ld BODY: %s\n", status, response.c_str());
 
-struct EventHandler {
-	virtual void handleEvent(const std::string &eventName, json_t *event) = 0;
+	// the lambda api answers with an error status if the function is unknown or overloaded
+	if (status < 200 || status >= 300) {
+		fprintf(stderr, "Failed to invoke the handler lambda subscribed to this event\n");
+		return false;
+	}
+	return true;
+}
 
-	virtual ~EventHandler() {
-	};
+// a subscription of a lambda to the events on keys with a prefix and/or suffix, events are 
+// delivered through the bucket's outbox
+struct LambdaEventHandler {
+	std::string lambdaArn;
+	uint32_t eventMask = 0; // eventTypeBit of every event type that is subscribed to
+	std::string prefix;
+	std::string suffix;
+	uint32_t batchSize = 1; // the most records to deliver in one invocation
+	uint32_t batchWindowMs = 0; // how long a partial batch may wait for more records
+
+	bool matchesKey(const std::string& key) const {
+		return key.length() >= this->prefix.length() + this->suffix.length() &&
+			key.compare(0, this->prefix.length(), this->prefix) == 0 &&
+			key.compare(key.length() - this->suffix.length(), this->suffix.length(), this->suffix) == 0;
+	}
 };
 
-struct LambdaEventHandler : public EventHandler {
-	std::string lambdaArn;
-	std::shared_ptr<EventFilter> eventFilter;
+// rules of a notification configuration compiled into a trie over the key prefixes (or over the
+// reversed key suffixes), so that finding the rules for a key costs one step per character of 
+// the key no matter how many rules the configuration has. Every node knows which event types are
+// subscribed to anywhere below it, so a walk stops as soon as nothing further down can match.
+class S3NotificationRuleTrie {
+	struct Node {
+		std::map<unsigned char, std::unique_ptr<Node>> children;
+		std::vector<std::shared_ptr<LambdaEventHandler>> handlers; // rules whose prefix ends here
+		uint32_t subtreeMask = 0;
+	};
 
-	virtual void handleEvent(const std::string &eventName, json_t *event) override {
-		if (!eventFilter->filter(eventName, event)) {
-			fprintf(stdout, "not invoking lambda %s, did not pass filter\n", lambdaArn.c_str());
-			return ;
-		}
+	Node root;
+	bool reversed; // keyed on suffixes, read from the end of the key
 
-		// TODO: change this to use RabbitMQ to guarantee the delivery and execution
-		// of event notifications
+public:
+	S3NotificationRuleTrie(bool reversed) : reversed(reversed) {
+	}
 
-		std::unique_ptr<char[]> dump(json_dumps(event, 0));
-		
-		fprintf(stdout, "attempting to invoke lambda '%s'\n", this->lambdaArn.c_str());
-		const std::string lambdaName = getNameFromLambdaArn(this->lambdaArn.c_str());
-		
-		struct _u_map req_headers;
-		u_map_init(&req_headers);
-		u_map_put(&req_headers, "Content-Type", "application/json");
-		u_map_put(&req_headers, "X-Amz-Invocation-Type", "Event");
-	
-		struct _u_request request;
-		ulfius_init_request(&request);
-		request.http_verb = strdup("POST");
-		std::string http_url = (
-			std::string(LAMBDA_API_ENDPOINT "/2015-03-31/functions/") +
-			lambdaName.c_str() + std::string("/invocations")).c_str();
-		request.http_url = strdup(http_url.c_str());
-		request.timeout = 30;
-		u_map_copy_into(request.map_header, &req_headers);
-
-		request.binary_body = (char *)dump.get();
-		request.binary_body_length = strlen(dump.get());
-
-		struct _u_response response;
-		fprintf(stdout, "Making HTTP request to URL %s\n", request.http_url);
-		ulfius_init_response(&response);
-		int retval = ulfius_send_http_request(&request, &response);
-		if (retval == U_OK) {
-			fprintf(stdout, "The HTTP response was U_OK, successful\n");
-
-			char *response_body = (char *) malloc(response.binary_body_length + 10);
-			strncpy(response_body, (char *)response.binary_body, response.binary_body_length);
-			response_body[response.binary_body_length] = '\0';
-			fprintf(stdout, "RESPONSE BODY: %s\n", response_body);
-			free(response_body);
-		} else {
-			fprintf(stderr, "Failed to invoke the handler lambda subscribed to this event\n");
+	void add(const std::shared_ptr<LambdaEventHandler>& handler) {
+		const std::string& path = this->reversed ? handler->suffix : handler->prefix;
+		Node *node = &this->root;
+		node->subtreeMask |= handler->eventMask;
+		for (size_t i = 0; i < path.length(); ++i) {
+			unsigned char c = this->reversed ? path[path.length() - 1 - i] : path[i];
+			std::unique_ptr<Node>& child = node->children[c];
+			if (child == nullptr)
+				child = std::unique_ptr<Node>(new Node);
+			node = child.get();
+			node->subtreeMask |= handler->eventMask;
 		}
-		ulfius_clean_response(&response);
-
-		u_map_clean(&req_headers);
+		node->handlers.push_back(handler);
 	}
 
-	virtual ~LambdaEventHandler() {
-
+	// appends every handler subscribed to the event type whose rules the key satisfies. The walk
+	// only follows one side of the key, the other side of a combined rule is checked directly.
+	void match(uint32_t eventBit, const std::string& key, 
+		std::vector<std::shared_ptr<LambdaEventHandler>>& matched) const {
+		const Node *node = &this->root;
+		size_t depth = 0;
+		while ((node->subtreeMask & eventBit) != 0) {
+			for (const auto& handler : node->handlers) {
+				if ((handler->eventMask & eventBit) != 0 && handler->matchesKey(key))
+					matched.push_back(handler);
+			}
+			if (depth == key.length())
+				break;
+			unsigned char c = this->reversed ? key[key.length() - 1 - depth] : key[depth];
+			depth++;
+			auto child = node->children.find(c);
+			if (child == node->children.end())
+				break;
+			node = child->second.get();
+		}
 	}
 };
 
+// writes json into a fixed buffer, once the buffer is full everything else is dropped and
+// overflowed is set
+struct JsonBufferWriter {
+	char *buffer;
+	size_t capacity;
+	size_t length = 0;
+	bool overflowed = false;
 
-class EventFilterAnd : public EventFilter {
-public:
-	vector<shared_ptr<EventFilter>> filters;
+	JsonBufferWriter(char *buffer, size_t capacity) : buffer(buffer), capacity(capacity) {
+	}
 
-	virtual bool filter(const std::string &eventName, json_t *event) override {
-		fprintf(stdout, "evaluating EventAndFilter in response to event %s\n", eventName.c_str());
-		for (auto& filter : this->filters) {
-			if (!filter->filter(eventName, event))
-				return false;
+	void write(const char *data, size_t n) {
+		if (n > this->capacity - this->length) {
+			this->overflowed = true;
+			return;
 		}
-		return true;
+		memcpy(this->buffer + this->length, data, n);
+		this->length += n;
 	}
 
-	void addFilter(shared_ptr<EventFilter> &&filter) {
-		this->filters.push_back(filter);
+	void write(const std::string& data) {
+		this->write(data.c_str(), data.length());
 	}
 
-	virtual ~EventFilterAnd() override {
+	// writes the contents of a json string, quotes and control characters are escaped
+	void writeEscaped(const char *data, size_t n) {
+		static const char hex[] = "0123456789abcdef";
+		const char *run = data; // characters that can be copied as they are
+		for (const char *c = data; c < data + n; ++c) {
+			unsigned char ch = (unsigned char)*c;
+			if (ch >= 0x20 && ch != '"' && ch != '\\')
+				continue;
+			this->write(run, c - run);
+			run = c + 1;
+			char escape[6] = {'\\', 'u', '0', '0', hex[ch >> 4], hex[ch & 0xf]};
+			switch (ch) {
+			case '"': this->write("\\\"", 2); break;
+			case '\\': this->write("\\\\", 2); break;
+			case '\n': this->write("\\n", 2); break;
+			case '\r': this->write("\\r", 2); break;
+			case '\t': this->write("\\t", 2); break;
+			default: this->write(escape, sizeof(escape)); break;
+			}
+		}
+		this->write(run, data + n - run);
 	}
-};
 
-class S3EventFilterPrefix : public EventFilter {
-public:
-	const string prefix;
+	void writeUnsigned(uint64_t value) {
+		char digits[20];
+		size_t n = 0;
+		do {
+			digits[sizeof(digits) - ++n] = '0' + value % 10;
+			value /= 10;
+		} while (value != 0);
+		this->write(digits + sizeof(digits) - n, n);
+	}
+
+	// writes the time as ISO 8601 in UTC with milliseconds, e.g. 2018-09-21T20:58:44.123Z
+	void writeTime(int64_t timeMs) {
+		int64_t days = timeMs / 86400000;
+		int64_t msOfDay = timeMs % 86400000;
+		if (msOfDay < 0) {
+			msOfDay += 86400000;
+			days--;
+		}
 
-	S3EventFilterPrefix(const std::string& prefix) : prefix(prefix) {
+		// civil date from days since the epoch, see http://howardhinnant.github.io/date_algorithms.html
+		days += 719468;
+		int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+		unsigned doe = (unsigned)(days - era * 146097);
+		unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+		int64_t year = (int64_t)yoe + era * 400;
+		unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+		unsigned mp = (5 * doy + 2) / 153;
+		unsigned day = doy - (153 * mp + 2) / 5 + 1;
+		unsigned month = mp < 10 ? mp + 3 : mp - 9;
+		if (month <= 2)
+			year++;
+
+		unsigned fields[] = {
+			(unsigned)year, month, day, 
+			(unsigned)(msOfDay / 3600000), (unsigned)(msOfDay / 60000 % 60), (unsigned)(msOfDay / 1000 % 60), 
+			(unsigned)(msOfDay % 1000)
+		};
+		const char separators[] = "--T::.Z";
+		const int widths[] = {4, 2, 2, 2, 2, 2, 3};
+		char out[sizeof("2000-00-00T00:00:00.000Z") - 1];
+		char *pos = out;
+		for (int i = 0; i < 7; ++i) {
+			for (int w = widths[i] - 1; w >= 0; --w) {
+				unsigned value = fields[i];
+				for (int d = 0; d < w; ++d)
+					value /= 10;
+				*pos++ = '0' + value % 10;
+			}
+			*pos++ = separators[i];
+		}
+		this->write(out, sizeof(out));
 	}
+};
 
-	virtual bool filter(const std::string &eventName, json_t *event) override {
-		fprintf(stdout, "evaluating S3EventFilterPrefix in response to event %s\n", eventName.c_str());
-		json_t *records = json_object_get(event, "Records");
-		if (!records || json_array_size(records) != 1) 
-			return false;
-		json_t *firstRecord = json_array_get(records, (size_t)0);
-		json_t *s3 = json_object_get(firstRecord, "s3");
-		if (!s3) 
-			return false;
-		json_t *object = json_object_get(s3, "object");
-		if (!object) 
-			return false;
-		const char *key = json_string_value(json_object_get(object, "key"));
-		if (!key)
-			return false;
-		// check that the two strings have the same prefix
-		fprintf(stdout, "comparing %s with %s\n", key, prefix.c_str());
-		if (strncmp(key, prefix.c_str(), prefix.length()) != 0)
-			return false;
-		return true;
+// the json of an event record with everything that is the same for every event in a bucket 
+// rendered ahead of time, so that producing a record is a single pass over a caller supplied
+// buffer that splices in the event name, time, key and size. 
+// https://docs.aws.amazon.com/AmazonS3/latest/dev/notification-content-structure.html
+class S3EventTemplate {
+	std::string beforeEventName;
+	std::string beforeEventTime;
+	std::string beforeKey;
+	std::string beforeSize;
+	std::string end;
+
+public:
+	S3EventTemplate(const std::string& bucket_name) {
+		std::string escapedName(bucket_name.length() * 6, '\0');
+		JsonBufferWriter name(&escapedName[0], escapedName.length());
+		name.writeEscaped(bucket_name.c_str(), bucket_name.length());
+		escapedName.resize(name.length);
+
+		this->beforeEventName = std::string("{\"eventVersion\":\"2.0\",\"eventSource\":\"aws:s3\","
+			"\"awsRegion\":\"" FAKE_REGION "\",\"eventName\":\"");
+		this->beforeEventTime = "\",\"eventTime\":\"";
+		this->beforeKey = "\",\"s3\":{\"s3SchemaVersion\":\"1.0\",\"bucket\":{\"name\":\"" + escapedName + 
+			"\",\"arn\":\"arn:aws:s3:::" + escapedName + "\"},\"object\":{\"key\":\"";
+		this->beforeSize = "\",\"size\":";
+		this->end = "}}}";
 	}
 
-	virtual ~S3EventFilterPrefix() {
+	// returns the length of the record, or 0 if it did not fit in the buffer
+	size_t render(char *buffer, size_t capacity, const char *eventName, 
+		const std::string& key, uint64_t size, int64_t timeMs) const {
+		JsonBufferWriter writer(buffer, capacity);
+		writer.write(this->beforeEventName);
+		writer.writeEscaped(eventName, strlen(eventName));
+		writer.write(this->beforeEventTime);
+		writer.writeTime(timeMs);
+		writer.write(this->beforeKey);
+		writer.writeEscaped(key.c_str(), key.length());
+		writer.write(this->beforeSize);
+		writer.writeUnsigned(size);
+		writer.write(this->end);
+		return writer.overflowed ? 0 : writer.length;
 	}
 };
 
@@ -158,7 +352,7 @@ public:
 //       "eventSource": "aws:s3",
 //       "awsRegion": "us-west-1",
 //       "eventName": "s3:ObjectCreated:Put",
-//       "eventTime": "2018-09-21T20:58:44Z",
+//       "eventTime": "2018-09-21T20:58:44.123Z",
 //       "s3": {
 //         "s3SchemaVersion": "1.0",
 //         "bucket": {
@@ -174,13 +368,14 @@ public:
 //   ]
 // }
 
-class S3NotificationConfiguration {
-public:
 
-	unordered_map<
-		string, 
-		vector<unique_ptr<EventHandler>>> handlerMap;
+class S3NotificationConfiguration {
+	// rules with a prefix (and rules without any key filter) are found through prefixRules, rules
+	// that only filter on a suffix through suffixRules
+	S3NotificationRuleTrie prefixRules = S3NotificationRuleTrie(false);
+	S3NotificationRuleTrie suffixRules = S3NotificationRuleTrie(true);
 
+public:
 	S3NotificationConfiguration(std::istream& stream) {
 		std::string str((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
 		fprintf(stdout, "read notification configuration from disk: %s\n", str.c_str());
@@ -195,12 +390,16 @@ public:
 		this->loadFromXML(xmldocument);
 	}
 
-	void notify(const std::string& eventName, json_t *event) {
-		if (handlerMap.find(eventName) != handlerMap.end()) {
-			for (const auto& handler : handlerMap[eventName]) {
-				handler->handleEvent(eventName, event);
-			}
+	// returns every handler subscribed to the event on the key, evaluated while the bucket is
+	// locked and before the event itself is built
+	vector<shared_ptr<LambdaEventHandler>> match(const std::string& eventName, const std::string& key) const {
+		vector<shared_ptr<LambdaEventHandler>> matched;
+		uint32_t eventBit = eventTypeBit(eventName);
+		if (eventBit != 0) {
+			this->prefixRules.match(eventBit, key, matched);
+			this->suffixRules.match(eventBit, key, matched);
 		}
+		return matched;
 	}
 
 private:
@@ -226,54 +425,71 @@ private:
 		if (funcArnNode == nullptr) 
 			throw AWSError(500, "CloudFunctionConfiguration did not contain a 'CloudFunction' node specifying the function arn to invoke");
 
-		const char *funcArn = funcArnNode->value();
+		shared_ptr<LambdaEventHandler> handler(new LambdaEventHandler());
+		handler->lambdaArn = funcArnNode->value();
 
 		// try to decode any filters if possible
 		xml_node<T> *filterNode = cloudFuncConfig.first_node("Filter");
-		shared_ptr<EventFilter> eventFilter;
 		if (filterNode != nullptr) {
-			eventFilter = this->decodeFilter(*filterNode);
-		} else {
-			eventFilter = std::shared_ptr<EventFilter>(new EventFilterAnd);
+			this->decodeFilter(*filterNode, *handler);
 		}
 
+		// events are delivered one per invocation unless the configuration asks for batches
+		handler->batchSize = this->decodeBatchSetting(cloudFuncConfig, "BatchSize", 1, MAX_NOTIFICATION_BATCH_SIZE, 1);
+		handler->batchWindowMs = this->decodeBatchSetting(cloudFuncConfig, 
+			"MaximumBatchingWindowInMilliseconds", 0, MAX_NOTIFICATION_BATCH_WINDOW_MS, 0);
+
+		// event names may contain wild cards anywhere, e.g. s3:ObjectCreated:* or s3:Object*
 		for (xml_node<T>* node = cloudFuncConfig.first_node("Event"); node != nullptr; node = node->next_sibling("Event")) {
-			const char *event = node->value();
-			int event_len = strlen(event);
-
-			// we just ignore the last character if its a wild card
-			if (event[event_len - 1] == '*')
-				event_len--;
-			
-			// check if it is a valid event type
-			for (const char *eventType : eventTypes) {
-				if (strncmp(event, eventType, event_len) == 0) {
-					fprintf(stdout, "\tadded handler '%s' -> invoke '%s'\n", eventType, funcArn);
-					unique_ptr<LambdaEventHandler> handler(new LambdaEventHandler());
-					handler->lambdaArn = funcArn;
-					handler->eventFilter = eventFilter;
-					
-					if (this->handlerMap.find(eventType) == this->handlerMap.end()) {
-						this->handlerMap[eventType] = vector<unique_ptr<EventHandler>>();
-					}
-					this->handlerMap[eventType].push_back(std::move(handler));
-				}
+			uint32_t mask = eventTypeMask(node->value());
+			if (mask == 0) {
+				fprintf(stderr, "\tignoring event '%s', it does not match any supported event type\n", node->value());
 			}
+			for (size_t i = 0; i < eventTypes.size(); ++i) {
+				if ((mask & (1u << i)) != 0)
+					fprintf(stdout, "\tadded handler '%s' -> invoke '%s'\n", eventTypes[i], handler->lambdaArn.c_str());
+			}
+			handler->eventMask |= mask;
 		}
+
+		if (handler->eventMask == 0)
+			return;
+		if (handler->prefix.empty() && !handler->suffix.empty())
+			this->suffixRules.add(handler);
+		else
+			this->prefixRules.add(handler);
 	}
 
-	// takes the filter node as its argument
 	template<typename T>
-	shared_ptr<EventFilter> decodeFilter(xml_node<T>& filter_node) {
-		shared_ptr<EventFilterAnd> andFilter = shared_ptr<EventFilterAnd>(new EventFilterAnd);
-		
+	uint32_t decodeBatchSetting(xml_node<T>& cloudFuncConfig, const char *name, 
+		unsigned long min, unsigned long max, uint32_t defaultValue) {
+		xml_node<T> *node = cloudFuncConfig.first_node(name);
+		if (node == nullptr)
+			return defaultValue;
+
+		char *end = nullptr;
+		unsigned long value = strtoul(node->value(), &end, 10);
+		if (end == node->value() || *end != '\0' || value < min || value > max) {
+			fprintf(stderr, "Fatal error: %s must be between %lu and %lu\n", name, min, max);
+			throw AWSError(500, "ServiceException").setDetails(std::string(name) + " is out of range");
+		}
+		fprintf(stdout, "\t%s: %lu\n", name, value);
+		return (uint32_t)value;
+	}
+
+	// takes the filter node as its argument, the rules it contains are stored in the handler
+	template<typename T>
+	void decodeFilter(xml_node<T>& filter_node, LambdaEventHandler& handler) {
 		fprintf(stdout, "\tdecoding a filter to apply to these events\n");
 		xml_node<T> *s3key = filter_node.first_node("S3Key");
 		if (s3key != nullptr) {
-			// okay this means we are filtering on the S3Key clearly
+			// okay this means we are filtering on the S3Key clearly, a key has to satisfy every
+			// rule (at most one prefix and one suffix)
+			bool havePrefix = false;
+			bool haveSuffix = false;
 			for (auto filterRule = s3key->first_node("FilterRule"); 
 				filterRule != nullptr;
-				filterRule = s3key->next_sibling("FilterRule")) {
+				filterRule = filterRule->next_sibling("FilterRule")) {
 				
 				auto name = filterRule->first_node("Name");
 				auto value = filterRule->first_node("Value");
@@ -283,19 +499,23 @@ private:
 					throw AWSError(500, "ServiceException").setDetails("malformatted filter expression");
 				}
 
-				if (strcmp(name->value(), "prefix") != 0) {
-					throw AWSError(500, "ServiceException").setDetails("filters on prefix are the only types of filters supported");
+				if (strcasecmp(name->value(), "prefix") == 0) {
+					if (havePrefix) 
+						throw AWSError(500, "ServiceException").setDetails("a filter can only have one prefix rule");
+					fprintf(stdout, "\t\tfilter by prefix: %s\n", value->value());
+					handler.prefix = value->value();
+					havePrefix = true;
+				} else if (strcasecmp(name->value(), "suffix") == 0) {
+					if (haveSuffix) 
+						throw AWSError(500, "ServiceException").setDetails("a filter can only have one suffix rule");
+					fprintf(stdout, "\t\tfilter by suffix: %s\n", value->value());
+					handler.suffix = value->value();
+					haveSuffix = true;
+				} else {
+					throw AWSError(500, "ServiceException").setDetails("filters on prefix and suffix are the only types of filters supported");
 				}
-				
-				fprintf(stdout, "\t\tfilter by prefix: %s\n", value->value());
-				std::string filterPrefix = std::string(value->value());
-				andFilter->addFilter(std::shared_ptr<EventFilter>(
-					new S3EventFilterPrefix(filterPrefix)
-				));
 			}
 		}
-
-		return andFilter; // requires all filters added to it return true
 	}
 };
 
@@ -304,12 +524,18 @@ private:
 	<CloudFunctionConfiguration>
 		<CloudFunction>arn:aws:lambda:function:handler</CloudFunction>
 		<Event>s3:ObjectCreated:*</Event>
+		<BatchSize>100</BatchSize>
+		<MaximumBatchingWindowInMilliseconds>500</MaximumBatchingWindowInMilliseconds>
 		<Filter>
 			<S3Key>
 				<FilterRule>
 					<Name>prefix</Name>
 					<Value>test</Value>
 				</FilterRule>
+				<FilterRule>
+					<Name>suffix</Name>
+					<Value>.jpg</Value>
+				</FilterRule>
 			</S3Key>
 		</Filter>
 	</CloudFunctionConfiguration>
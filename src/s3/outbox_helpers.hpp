@@ -0,0 +1,450 @@
+#ifndef OUTBOX_HELPERS_HPP
+#define OUTBOX_HELPERS_HPP
+
+#include <dirent.h>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <unordered_map>
+#include <condition_variable>
+
+#define MAX_OUTBOX_ENTRIES (4096)
+#define MAX_OUTBOX_RECORD_LENGTH (2048)
+#define MAX_OUTBOX_ARN_LENGTH (256)
+#define MAX_OUTBOX_KEY_LENGTH (256 + 1) // MAX_PATH_LENGTH of an index entry and its terminator
+#define OUTBOX_DELIVERIES_PER_TURN (64) // batches sent from one outbox before moving on to the next
+#define OUTBOX_RETRY_INITIAL_MS (100)
+#define OUTBOX_RETRY_MAX_MS (30 * 1000)
+
+inline int64_t outboxTimeMs() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// an event waiting to be delivered to one lambda, lives in the outbox WooF of the subscription
+// it was recorded for. The batching settings of the subscription travel with every record so 
+// that delivery does not depend on the notification configuration that is current.
+struct S3OutboxRecord {
+	char lambdaArn[MAX_OUTBOX_ARN_LENGTH];
+	char eventName[64];
+	int64_t timeMs = 0; // milliseconds since the epoch when the event was recorded
+	uint32_t batchSize = 1; // the most records to send in one invocation
+	uint32_t batchWindowMs = 0; // how long to wait for a batch to fill up
+	uint32_t length = 0;
+	// the index entry the event describes, the record is only delivered once that entry is in
+	// the index log (see outboxRecordCommitted)
+	uint64_t indexSeqno = 0;
+	char key[MAX_OUTBOX_KEY_LENGTH];
+	char record[MAX_OUTBOX_RECORD_LENGTH]; // one entry of the Records array, serialized as json
+
+	S3OutboxRecord() {
+		memset(this->lambdaArn, 0, sizeof(this->lambdaArn));
+		memset(this->eventName, 0, sizeof(this->eventName));
+		memset(this->key, 0, sizeof(this->key));
+		memset(this->record, 0, sizeof(this->record));
+	}
+
+	void setIndexEntry(uint64_t indexSeqno, const char *key) {
+		this->indexSeqno = indexSeqno;
+		strncpy(this->key, key, sizeof(this->key) - 1);
+	}
+
+	// describes the length bytes that were rendered into record
+	void setEvent(const char *eventName, int64_t timeMs, size_t length) {
+		strncpy(this->eventName, eventName, sizeof(this->eventName) - 1);
+		this->timeMs = timeMs;
+		this->length = length;
+	}
+
+	void setSubscription(const char *lambdaArn, uint32_t batchSize, uint32_t batchWindowMs) {
+		strncpy(this->lambdaArn, lambdaArn, sizeof(this->lambdaArn) - 1);
+		this->batchSize = batchSize;
+		this->batchWindowMs = batchWindowMs;
+	}
+};
+
+// true if the index entry the record describes made it into the bucket's index log, defined
+// next to the index (s3_client.cpp)
+bool outboxRecordCommitted(const std::string& outboxName, const S3OutboxRecord& record);
+
+// the events of a subscription that still have to be delivered. Records are staged in a WooF
+// while the bucket is locked, before the index entries they describe are appended, and committed
+// for delivery after. A crash in between leaves records whose index entry never landed, the 
+// dispatcher skips those. The seqno of the last record that was delivered is kept in an ack file
+// next to the WooF so that delivery picks up where it left off when the s3_client restarts.
+class S3NotificationOutbox {
+	std::string woofName;
+	std::string ackPath;
+
+	std::mutex lock; // guards acked, latest and written
+	unsigned long acked = 0; // every record up to and including this seqno has been delivered
+	unsigned long latest = 0; // the newest record that is committed for delivery
+	unsigned long written = 0; // the newest record in the WooF, staged or committed
+
+public:
+	S3NotificationOutbox(const std::string& woofName) : woofName(woofName), ackPath(woofName + ".ack") {
+		struct stat st = {0};
+		if (stat(this->woofName.c_str(), &st) == -1) {
+			fprintf(stdout, "Created outbox woof %s\n", this->woofName.c_str());
+			if (WooFCreate((char *)this->woofName.c_str(), sizeof(S3OutboxRecord), MAX_OUTBOX_ENTRIES) != 1) {
+				throw AWSError(500, "failed to create the WooF for the bucket's notification outbox");
+			}
+		}
+
+		unsigned long seqno = WooFGetLatestSeqno((char *)this->woofName.c_str());
+		if (!WooFInvalid(seqno))
+			this->latest = this->written = seqno;
+
+		FILE *fp = fopen(this->ackPath.c_str(), "r");
+		if (fp != NULL) {
+			if (fscanf(fp, "%lu", &this->acked) != 1)
+				this->acked = 0;
+			fclose(fp);
+		}
+		if (this->acked > this->latest)
+			this->acked = this->latest;
+		fprintf(stdout, "outbox %s: %lu events waiting to be delivered\n",
+			this->woofName.c_str(), this->latest - this->acked);
+	}
+
+	const std::string& getName() const {
+		return this->woofName;
+	}
+
+	// false if staging count more records would overwrite ones that have not been delivered
+	bool hasRoom(unsigned long count) {
+		std::lock_guard<std::mutex> g(this->lock);
+		return this->written - this->acked + count <= MAX_OUTBOX_ENTRIES;
+	}
+
+	// writes the record to the WooF without making it visible to the dispatcher, returns false if
+	// it could not be written. The caller checks hasRoom first.
+	bool stage(const S3OutboxRecord& record) {
+		std::lock_guard<std::mutex> g(this->lock);
+		unsigned long seqno = WooFPut((char *)this->woofName.c_str(), NULL, (void *)&record);
+		if (WooFInvalid(seqno))
+			return false;
+		this->written = seqno;
+		return true;
+	}
+
+	// makes every staged record visible to the dispatcher
+	void commit() {
+		std::lock_guard<std::mutex> g(this->lock);
+		this->latest = this->written;
+	}
+
+	unsigned long pending() {
+		std::lock_guard<std::mutex> g(this->lock);
+		return this->latest - this->acked;
+	}
+
+	// the seqno of the oldest record that has not been delivered, 0 if there is none
+	unsigned long nextSeqno() {
+		std::lock_guard<std::mutex> g(this->lock);
+		return this->latest > this->acked ? this->acked + 1 : 0;
+	}
+
+	bool getRecord(unsigned long seqno, S3OutboxRecord& record) {
+		return WooFGet((char *)this->woofName.c_str(), (void *)&record, seqno) == 1;
+	}
+
+	// marks every record up to and including seqno as delivered
+	void ack(unsigned long seqno) {
+		std::lock_guard<std::mutex> g(this->lock);
+		if (seqno <= this->acked)
+			return;
+		this->acked = seqno;
+
+		std::string tmpPath = this->ackPath + ".tmp";
+		FILE *fp = fopen(tmpPath.c_str(), "w");
+		if (fp == NULL) {
+			fprintf(stderr, "failed to persist the ack of outbox %s\n", this->woofName.c_str());
+			return;
+		}
+		fprintf(fp, "%lu\n", seqno);
+		fclose(fp);
+		if (rename(tmpPath.c_str(), this->ackPath.c_str()) != 0) {
+			fprintf(stderr, "failed to persist the ack of outbox %s\n", this->woofName.c_str());
+		}
+	}
+};
+
+// delivers the records in the outboxes on a pool of threads so that requests never wait on the
+// handlers. Each outbox is worked on by at most one thread at a time, which delivers its records
+// in order, up to batchSize records per invocation. An outbox holding fewer records than that 
+// waits up to batchWindowMs after its oldest record for more to arrive. When a delivery fails the
+// outbox backs off exponentially and retries from the same record, so a delivery that failed 
+// after the invocation was queued is repeated: records are delivered at least once.
+class NotificationDispatcher {
+public:
+	struct Stats {
+		size_t outboxes = 0;
+		uint64_t queueDepth = 0; // records waiting to be delivered, across every outbox
+		uint64_t delivered = 0;
+		uint64_t invocations = 0;
+		uint64_t retries = 0;
+		uint64_t dropped = 0;
+		uint64_t uncommitted = 0; // staged records whose index entry never landed, skipped
+		long long oldestPendingMs = 0; // age of the oldest record that has not been delivered
+		long long lastDeliveryLagMs = 0; // how long the last delivered record waited in its outbox
+	};
+
+private:
+	struct OutboxState;
+	typedef std::multimap<std::chrono::steady_clock::time_point, OutboxState *> WaitMap;
+
+	struct OutboxState {
+		std::shared_ptr<S3NotificationOutbox> outbox;
+		bool scheduled = false; // queued, waiting or being delivered by a thread
+		unsigned attempts = 0; // consecutive failed deliveries
+		uint32_t batchSize = 0; // set while the outbox is waiting for a batch to fill up
+		WaitMap::iterator waiting; // valid while batchSize is set
+	};
+
+	enum DeliveryResult {
+		DELIVERED, // the outbox is empty or has had its turn
+		FAILED,
+		BATCHING // there is a partial batch that is not due yet
+	};
+
+	std::mutex lock;
+	std::condition_variable ready;
+	std::unordered_map<std::string, std::unique_ptr<OutboxState>> outboxes;
+	std::deque<OutboxState *> queue; // outboxes with records to deliver
+	WaitMap waiting; // outboxes backing off or waiting for a batch to fill up
+	std::vector<std::thread> threads;
+	bool stopping = false;
+	Stats stats;
+
+	// must be called with lock held
+	void schedule(OutboxState *state) {
+		if (state->scheduled)
+			return;
+		state->scheduled = true;
+		this->queue.push_back(state);
+		this->ready.notify_one();
+	}
+
+	// delivers batches from the outbox until it is empty, a delivery fails or it has had its turn.
+	// when the next batch is partial and not due yet, dueAt is set to when it will be.
+	DeliveryResult deliver(S3NotificationOutbox &outbox, uint32_t& batchSize, std::chrono::steady_clock::time_point& dueAt) {
+		for (int i = 0; i < OUTBOX_DELIVERIES_PER_TURN; ++i) {
+			unsigned long first = outbox.nextSeqno();
+			if (first == 0)
+				return DELIVERED;
+
+			S3OutboxRecord record;
+			if (!outbox.getRecord(first, record)) {
+				fprintf(stderr, "outbox %s: record %lu is missing, skipping it\n", outbox.getName().c_str(), first);
+				outbox.ack(first);
+				std::lock_guard<std::mutex> g(this->lock);
+				this->stats.dropped++;
+				continue;
+			}
+			if (!outboxRecordCommitted(outbox.getName(), record)) {
+				fprintf(stderr, "outbox %s: the index entry of record %lu never landed, skipping it\n", 
+					outbox.getName().c_str(), first);
+				outbox.ack(first);
+				std::lock_guard<std::mutex> g(this->lock);
+				this->stats.uncommitted++;
+				continue;
+			}
+
+			unsigned long pending = outbox.pending();
+			batchSize = std::max<uint32_t>(record.batchSize, 1);
+			int64_t waitedMs = outboxTimeMs() - record.timeMs;
+			if (pending < batchSize && waitedMs < record.batchWindowMs) {
+				dueAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(record.batchWindowMs - waitedMs);
+				return BATCHING;
+			}
+
+			// the batch is the run of records starting at first, cut short if it would not fit
+			// in one invocation
+			std::string body = std::string("{\"Records\":[") + std::string(record.record, record.length);
+			unsigned long last = first;
+			int64_t oldestMs = record.timeMs;
+			while (last - first + 1 < std::min<unsigned long>(batchSize, pending)) {
+				S3OutboxRecord next;
+				if (!outbox.getRecord(last + 1, next) ||
+					body.length() + next.length + 3 > NOTIFICATION_MAX_BATCH_BYTES ||
+					!outboxRecordCommitted(outbox.getName(), next))
+					break;
+				body.append(",");
+				body.append(next.record, next.length);
+				last++;
+			}
+			body.append("]}");
+
+			if (!invokeLambdaWithEvent(record.lambdaArn, body))
+				return FAILED;
+			outbox.ack(last);
+
+			std::lock_guard<std::mutex> g(this->lock);
+			this->stats.delivered += last - first + 1;
+			this->stats.invocations++;
+			this->stats.lastDeliveryLagMs = outboxTimeMs() - oldestMs;
+		}
+		return DELIVERED;
+	}
+
+	void dispatchLoop() {
+		std::unique_lock<std::mutex> g(this->lock);
+		while (!this->stopping) {
+			// outboxes that are done waiting go to the back of the queue
+			auto now = std::chrono::steady_clock::now();
+			while (!this->waiting.empty() && this->waiting.begin()->first <= now) {
+				OutboxState *state = this->waiting.begin()->second;
+				state->batchSize = 0;
+				this->queue.push_back(state);
+				this->waiting.erase(this->waiting.begin());
+			}
+
+			if (this->queue.empty()) {
+				if (this->waiting.empty())
+					this->ready.wait(g);
+				else
+					this->ready.wait_until(g, this->waiting.begin()->first);
+				continue;
+			}
+
+			OutboxState *state = this->queue.front();
+			this->queue.pop_front();
+
+			g.unlock();
+			uint32_t batchSize = 0;
+			std::chrono::steady_clock::time_point dueAt;
+			DeliveryResult result = this->deliver(*state->outbox, batchSize, dueAt);
+			g.lock();
+
+			if (result == FAILED) {
+				state->attempts++;
+				this->stats.retries++;
+				long long delayMs = OUTBOX_RETRY_MAX_MS;
+				if (state->attempts < 16)
+					delayMs = std::min<long long>(OUTBOX_RETRY_INITIAL_MS << state->attempts, OUTBOX_RETRY_MAX_MS);
+				fprintf(stderr, "outbox %s: delivery failed, retrying in %lld ms\n",
+					state->outbox->getName().c_str(), delayMs);
+				this->waiting.insert(std::make_pair(
+					std::chrono::steady_clock::now() + std::chrono::milliseconds(delayMs), state));
+				this->ready.notify_one(); // someone has to wake up when the wait is over
+			} else if (result == BATCHING) {
+				state->attempts = 0;
+				// publish() cuts the wait short if the batch fills up in the meantime
+				state->batchSize = batchSize;
+				state->waiting = this->waiting.insert(std::make_pair(dueAt, state));
+				this->ready.notify_one();
+			} else {
+				state->attempts = 0;
+				if (state->outbox->pending() > 0)
+					this->queue.push_back(state);
+				else
+					state->scheduled = false;
+			}
+		}
+	}
+
+	// must be called with lock held
+	OutboxState *getOutboxState(const std::string& woofName) {
+		auto existing = this->outboxes.find(woofName);
+		if (existing != this->outboxes.end())
+			return existing->second.get();
+
+		std::unique_ptr<OutboxState> state(new OutboxState);
+		state->outbox = std::make_shared<S3NotificationOutbox>(woofName);
+		OutboxState *result = state.get();
+		this->outboxes[woofName] = std::move(state);
+		if (result->outbox->pending() > 0)
+			this->schedule(result);
+		return result;
+	}
+
+public:
+	NotificationDispatcher(size_t threadCount) {
+		for (size_t i = 0; i < threadCount; ++i) {
+			this->threads.push_back(std::thread(&NotificationDispatcher::dispatchLoop, this));
+		}
+	}
+
+	~NotificationDispatcher() {
+		{
+			std::lock_guard<std::mutex> g(this->lock);
+			this->stopping = true;
+		}
+		this->ready.notify_all();
+		for (auto& thread : this->threads) {
+			thread.join();
+		}
+	}
+
+	// opens (creating it if needed) the outbox stored in the WooF woofName, any records left in
+	// it from a previous run are scheduled for delivery
+	std::shared_ptr<S3NotificationOutbox> getOutbox(const std::string& woofName) {
+		std::lock_guard<std::mutex> g(this->lock);
+		return this->getOutboxState(woofName)->outbox;
+	}
+
+	// opens every outbox in the current directory so that records which were not delivered
+	// before a restart are sent without waiting for their bucket to be used again
+	void resume() {
+		DIR *dir = opendir(".");
+		if (dir == NULL)
+			return;
+		const std::string suffix = ".outbox";
+		struct dirent *ent;
+		while ((ent = readdir(dir)) != NULL) {
+			std::string name = ent->d_name;
+			if (name.length() > suffix.length() &&
+				name.compare(name.length() - suffix.length(), suffix.length(), suffix) == 0) {
+				this->getOutbox(name);
+			}
+		}
+		closedir(dir);
+	}
+
+	// commits the records staged in the outbox and makes sure they will be delivered
+	void publish(S3NotificationOutbox& outbox) {
+		outbox.commit();
+
+		std::lock_guard<std::mutex> g(this->lock);
+		OutboxState *state = this->getOutboxState(outbox.getName());
+		if (state->batchSize != 0 && outbox.pending() >= state->batchSize) {
+			// the batch it was waiting for is full, no reason to wait any longer
+			this->waiting.erase(state->waiting);
+			state->batchSize = 0;
+			this->queue.push_back(state);
+			this->ready.notify_one();
+		}
+		this->schedule(state);
+	}
+
+	Stats getStats() {
+		std::vector<std::shared_ptr<S3NotificationOutbox>> outboxes;
+		Stats current;
+		{
+			std::lock_guard<std::mutex> g(this->lock);
+			current = this->stats;
+			for (const auto& state : this->outboxes) {
+				outboxes.push_back(state.second->outbox);
+			}
+		}
+
+		current.outboxes = outboxes.size();
+		int64_t now = outboxTimeMs();
+		for (const auto& outbox : outboxes) {
+			current.queueDepth += outbox->pending();
+			unsigned long seqno = outbox->nextSeqno();
+			S3OutboxRecord record;
+			if (seqno != 0 && outbox->getRecord(seqno, record) && now - record.timeMs > current.oldestPendingMs)
+				current.oldestPendingMs = now - record.timeMs;
+		}
+		return current;
+	}
+};
+
+#endif
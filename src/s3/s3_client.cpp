@@ -8,10 +8,16 @@
 #include <mutex>
 #include <memory>
 #include <vector>
+#include <array>
+#include <algorithm>
+#include <cassert>
 #include <unordered_map>
+#include <unordered_set>
 #include <iostream>
 #include <csignal>
 #include <ctime>
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include <sstream>
 
@@ -25,6 +31,8 @@
 #include <lib/fsutil.hpp>
 #include <lib/helpers.hpp>
 #include <lib/sha256_util.hpp>
+#include <lib/md5_util.hpp>
+#include <lib/nsplatform.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -43,36 +51,80 @@ extern "C" {
 }
 
 #include "notification_helpers.hpp"
+#include "outbox_helpers.hpp"
 #include "s3filesystem.hpp"
+#include "multipart_helpers.hpp"
 
 #define MAX_PATH_LENGTH (256)
 #define PORT (8081)
 #define MAX_BUCKET_INDEX_ENTRIES (128 * 1024)
+#define MAX_DELETE_OBJECTS_KEYS (1000)
+#define MAX_CHANGE_FEED_ENTRIES (1000)
+#define MAX_CHANGE_FEED_WAIT_SECONDS (60)
+// bump whenever S3BucketIndexEntry changes, an index from before the version was recorded
+// (LegacyS3BucketIndexEntry) is migrated when the bucket is opened, other versions are not opened
+#define S3_BUCKET_INDEX_FORMAT_VERSION (2)
 
 // #define RUN_TESTS
 
 using namespace std;
 
 std::unique_ptr<S3FileSystem> s3fs = std::unique_ptr<S3FileSystem>(new S3FileSystem);
+S3MultipartUploadTable multipartUploads;
+std::unique_ptr<NotificationDispatcher> notificationDispatcher = std::unique_ptr<NotificationDispatcher>(
+	new NotificationDispatcher(NOTIFICATION_DISPATCH_THREADS));
 
 struct S3BucketIndexEntry {
+	// logref points at a manifest listing the parts of the object rather than the object itself
+	constexpr static uint32_t FLAG_MANIFEST = 1;
+
 	char name[MAX_PATH_LENGTH + 1]; // don't forget about the extra byte for null terminator
 	S3LogRef logref;
 	uint64_t size = 0;
+	uint32_t flags = 0;
+	char etag[48]; // hex md5 of the object (without quotes), or of the part md5s for multipart objects
+	int64_t lastModified = 0; // seconds since the epoch
 
 	S3BucketIndexEntry() {
 		memset(this->name, 0, sizeof(this->name));
+		memset(this->etag, 0, sizeof(this->etag));
 	}
 
 	S3BucketIndexEntry(const char *name, S3LogRef ref) : logref(ref) {
 		strncpy(this->name, name, sizeof(this->name) / sizeof(char));
 		// go ahead and ensure we always have a null termination, just makes life easier
 		this->name[MAX_PATH_LENGTH] = 0;
+		memset(this->etag, 0, sizeof(this->etag));
+		this->lastModified = time(NULL);
+	}
+
+	void setETag(const char *etag) {
+		strncpy(this->etag, etag, sizeof(this->etag) - 1);
 	}
 
-	bool isValid() {
+	// false for entries migrated from a legacy index
+	bool hasETag() const {
+		return this->etag[0] != '\0';
+	}
+
+	std::string getQuotedETag() const {
+		return std::string("\"") + this->etag + "\"";
+	}
+
+	bool isValid() const {
 		return this->logref.logId != -1;
 	}
+
+	bool isManifest() const {
+		return (this->flags & FLAG_MANIFEST) != 0;
+	}
+};
+
+// the index entry from before S3_BUCKET_INDEX_FORMAT_VERSION was recorded
+struct LegacyS3BucketIndexEntry {
+	char name[MAX_PATH_LENGTH + 1];
+	S3LogRef logref;
+	uint64_t size = 0;
 };
 
 class S3Bucket {
@@ -80,61 +132,299 @@ public:
 	std::string bucket_name;
 	std::string bucket_index_woof; // a woof that contains the name to storage location amppings for every file in the bucket
 	std::unique_ptr<S3NotificationConfiguration> notifConfig = nullptr;
+	const S3EventTemplate eventTemplate; // the parts of an event record that are the same for every object
 
 	// must be acquired for any operation on the bucket
 	std::mutex bucketLock;
+	// signalled (with bucketLock held) whenever entries are appended to the index log
+	std::condition_variable indexAppended;
+	// the seqno of the newest entry in the index log, 0 while the log is empty
+	unsigned long latestSeqno = 0;
 private:
+	// the outbox of every lambda subscribed to events in the bucket, keyed by its arn
+	std::unordered_map<std::string, std::shared_ptr<S3NotificationOutbox>> outboxes;
+
+	// the latest live entry for every key in the index log, rebuilt from the log when the bucket
+	// is opened and kept up to date by addToIndex. Keys that were removed have no entry.
+	std::unordered_map<std::string, S3BucketIndexEntry> liveEntries;
 
+	static std::mutex bucketsLock; // guards buckets, requests look up buckets concurrently
 	static std::unordered_map<std::string, std::unique_ptr<S3Bucket>> buckets;
 	
-	S3Bucket(const std::string &bucket_name) {
+	S3Bucket(const std::string &bucket_name) : eventTemplate(bucket_name) {
 		this->bucket_name = bucket_name;
 		this->bucket_index_woof = Base64encode(this->bucket_name);
 
+		// the element size of the index woof is sizeof(S3BucketIndexEntry), an index written with
+		// another layout can not be read. The layout is recorded next to the woof when it is created.
+		char format[64];
+		snprintf(format, sizeof(format), "S3BucketIndexEntry v%d %lu", 
+			S3_BUCKET_INDEX_FORMAT_VERSION, (unsigned long)sizeof(S3BucketIndexEntry));
+		std::string format_path = this->bucket_index_woof + ".format";
+
 		struct stat st = {0};
 		if (stat(this->bucket_index_woof.c_str(), &st) == -1) {
 			fprintf(stdout, "Created index woof for bucket %s (index woof name: %s)\n", this->bucket_name.c_str(), this->bucket_index_woof.c_str());
-			if (WooFCreate((char *)this->bucket_index_woof.c_str(), sizeof(S3BucketIndexEntry), MAX_BUCKET_INDEX_ENTRIES) != 1) {
-				throw AWSError(500, "failed to create the WooF for the bucket's index structure");
+			this->createIndex(format_path, format);
+		} else {
+			char existing[64] = {0};
+			FILE *format_file = fopen(format_path.c_str(), "r");
+			if (format_file != NULL) {
+				if (fgets(existing, sizeof(existing), format_file) == NULL)
+					existing[0] = '\0';
+				existing[strcspn(existing, "\n")] = '\0';
+				fclose(format_file);
+			}
+			if (format_file == NULL) {
+				// only indexes from before the format was recorded have no format file
+				this->migrateLegacyIndex(format_path, format);
+			} else if (strcmp(existing, format) != 0) {
+				fprintf(stderr, "Fatal error: the index woof %s of bucket %s was written in another format "
+					"(found '%s', expected '%s'), refusing to open it\n", this->bucket_index_woof.c_str(), 
+					this->bucket_name.c_str(), existing, format);
+				throw AWSError(500, "the bucket's index was written in an incompatible format");
+			}
+		}
+
+		unsigned long seqno = WooFGetLatestSeqno((char *)this->bucket_index_woof.c_str());
+		if (!WooFInvalid(seqno))
+			this->latestSeqno = seqno;
+		this->loadLiveEntries();
+	}
+
+	void createIndex(const std::string& format_path, const char *format) {
+		if (WooFCreate((char *)this->bucket_index_woof.c_str(), sizeof(S3BucketIndexEntry), MAX_BUCKET_INDEX_ENTRIES) != 1) {
+			throw AWSError(500, "failed to create the WooF for the bucket's index structure");
+		}
+		FILE *format_file = fopen(format_path.c_str(), "w");
+		if (format_file == NULL || fprintf(format_file, "%s\n", format) < 0 || fclose(format_file) != 0) {
+			throw AWSError(500, "failed to record the format of the bucket's index");
+		}
+	}
+
+	// rewrites an index in the layout from before the format was recorded into a new woof, the
+	// entries keep their order but have no etag and no modification time. The old woof is kept as
+	// <index>.legacy, and the format file is written last so an interrupted migration starts over.
+	void migrateLegacyIndex(const std::string& format_path, const char *format) {
+		std::string legacy_woof = this->bucket_index_woof + ".legacy";
+		struct stat st = {0};
+		if (stat(legacy_woof.c_str(), &st) == 0) {
+			// the woof next to the legacy one is a partial copy from an earlier attempt
+			if (unlink(this->bucket_index_woof.c_str()) != 0)
+				throw AWSError(500, "failed to restart the migration of the bucket's index");
+		} else if (rename(this->bucket_index_woof.c_str(), legacy_woof.c_str()) != 0) {
+			throw AWSError(500, "failed to move the bucket's index aside for migration");
+		}
+		fprintf(stdout, "migrating the index woof %s of bucket %s to %s\n", 
+			this->bucket_index_woof.c_str(), this->bucket_name.c_str(), format);
+
+		if (WooFCreate((char *)this->bucket_index_woof.c_str(), sizeof(S3BucketIndexEntry), MAX_BUCKET_INDEX_ENTRIES) != 1) {
+			throw AWSError(500, "failed to create the WooF for the bucket's index structure");
+		}
+
+		unsigned long migrated = 0;
+		unsigned long latest = WooFGetLatestSeqno((char *)legacy_woof.c_str());
+		if (!WooFInvalid(latest) && latest > 0) {
+			// older entries were overwritten in the ring already
+			unsigned long first = latest > MAX_BUCKET_INDEX_ENTRIES ? latest - MAX_BUCKET_INDEX_ENTRIES + 1 : 1;
+			for (unsigned long seqno = first; seqno <= latest; seqno++) {
+				LegacyS3BucketIndexEntry legacy;
+				if (WooFGet((char *)legacy_woof.c_str(), (void *)&legacy, seqno) != 1)
+					continue;
+				S3BucketIndexEntry entry(legacy.name, legacy.logref);
+				entry.size = legacy.size;
+				entry.lastModified = 0; // unknown
+				if (WooFInvalid(WooFPut((char *)this->bucket_index_woof.c_str(), NULL, (void *)&entry)))
+					throw AWSError(500, "failed to copy an entry of the bucket's index during migration");
+				migrated++;
+			}
+		}
+
+		FILE *format_file = fopen(format_path.c_str(), "w");
+		if (format_file == NULL || fprintf(format_file, "%s\n", format) < 0 || fclose(format_file) != 0) {
+			throw AWSError(500, "failed to record the format of the bucket's index");
+		}
+		fprintf(stdout, "migrated %lu entries of the index of bucket %s, the old index is kept in %s\n", 
+			migrated, this->bucket_name.c_str(), legacy_woof.c_str());
+	}
+
+	void loadLiveEntries() {
+		std::unordered_set<std::string> seen;
+		S3BucketIndexEntry entry;
+		signed long seqno = -1;
+		while ((seqno = this->getNextIndexEntry(seqno, entry)) != -1) {
+			// the log is walked newest first, so only the first entry seen for a key is current
+			if (!seen.insert(entry.name).second) 
+				continue;
+			if (entry.isValid())
+				this->liveEntries[entry.name] = entry;
+		}
+		fprintf(stdout, "loaded %lu live keys from the index of bucket %s\n", 
+			(unsigned long)this->liveEntries.size(), this->bucket_name.c_str());
+	}
+
+	// writes the event record of each entry to the outbox of every handler that wants it, the
+	// entries will get the index seqnos after latestSeqno. Returns the outboxes to commit once
+	// the entries are appended. Must be called with bucketLock held.
+	std::vector<S3NotificationOutbox *> stageEvents(const std::vector<S3BucketIndexEntry>& entries, const char *eventName) {
+		std::vector<S3NotificationOutbox *> outboxes;
+		if (eventName == nullptr || this->notifConfig == nullptr)
+			return outboxes;
+
+		std::vector<std::string> keys;
+		for (const auto& entry : entries) {
+			keys.push_back(entry.name);
+		}
+		this->checkEventRoom(keys, eventName);
+
+		std::vector<std::vector<std::shared_ptr<LambdaEventHandler>>> handlers;
+		for (const auto& key : keys) {
+			handlers.push_back(this->notifConfig->match(eventName, key));
+			for (const auto& handler : handlers.back()) {
+				S3NotificationOutbox *outbox = &this->getOutbox(handler->lambdaArn);
+				if (std::find(outboxes.begin(), outboxes.end(), outbox) == outboxes.end())
+					outboxes.push_back(outbox);
+			}
+		}
+
+		int64_t timeMs = outboxTimeMs();
+		for (size_t i = 0; i < entries.size(); ++i) {
+			if (handlers[i].empty())
+				continue;
+
+			// the record is rendered straight into the outbox record, the dispatcher wraps 
+			// batches of them in a Records array
+			const S3BucketIndexEntry& entry = entries[i];
+			S3OutboxRecord record;
+			size_t length = this->eventTemplate.render(record.record, sizeof(record.record), 
+				eventName, entry.name, entry.isValid() ? entry.size : 0, timeMs);
+			if (length == 0) {
+				fprintf(stderr, "Fatal error: failed to record the event %s for key %s\n", eventName, entry.name);
+				continue;
+			}
+			record.setEvent(eventName, timeMs, length);
+			record.setIndexEntry(this->latestSeqno + 1 + i, entry.name);
+			fprintf(stdout, "JSON EVENT NOTIFICATION: %.*s\n", (int)length, record.record);
+
+			for (const auto& handler : handlers[i]) {
+				record.setSubscription(handler->lambdaArn.c_str(), handler->batchSize, handler->batchWindowMs);
+				if (!this->getOutbox(handler->lambdaArn).stage(record)) {
+					throw AWSError(500, "failed to record the event in the outbox");
+				}
 			}
 		}
+		return outboxes;
 	}
 
 public:
 
-	void addToIndex(S3BucketIndexEntry entry) {
-		fprintf(stdout, "added key %s to index %s\n", entry.name, this->bucket_name.c_str());
-		if (WooFInvalid(WooFPut((char *)this->bucket_index_woof.c_str(), NULL, (void *)&entry))) {
+	// throws SlowDown if the events for the keys would not fit in the outboxes of the handlers
+	// that want them. A handler that can not keep up slows the writers down rather than losing
+	// events. Only this bucket writes to its outboxes, so with bucketLock held the room can only
+	// grow until the events are staged.
+	void checkEventRoom(const std::vector<std::string>& keys, const char *eventName) {
+		if (eventName == nullptr || this->notifConfig == nullptr)
+			return;
+
+		std::unordered_map<S3NotificationOutbox *, unsigned long> counts;
+		for (const auto& key : keys) {
+			for (const auto& handler : this->notifConfig->match(eventName, key)) {
+				counts[&this->getOutbox(handler->lambdaArn)]++;
+			}
+		}
+		for (const auto& count : counts) {
+			if (!count.first->hasRoom(count.second)) {
+				fprintf(stderr, "outbox %s is full, slowing down writes to bucket %s\n", 
+					count.first->getName().c_str(), this->bucket_name.c_str());
+				throw AWSError(503, "SlowDown");
+			}
+		}
+	}
+
+	// appends the entries to the index log, then brings the view of live entries up to date in
+	// a single pass. Each new entry takes a reference on the root it points at and the entries 
+	// they replace give theirs up, all in one batch so the reclaimer is woken once per call.
+	// With eventName, the event for each entry is staged in the outboxes of the handlers that
+	// want it before the entries are appended and committed for delivery after, throws SlowDown
+	// without appending anything if one of those outboxes is full.
+	void addToIndex(const std::vector<S3BucketIndexEntry>& entries, const char *eventName = nullptr) {
+		std::vector<S3NotificationOutbox *> staged = this->stageEvents(entries, eventName);
+
+		size_t appended = 0;
+		for (const auto& entry : entries) {
+			if (entry.isValid())
+				s3fs->acquire(entry.logref);
+			unsigned long seqno = WooFPut((char *)this->bucket_index_woof.c_str(), NULL, (void *)&entry);
+			if (WooFInvalid(seqno)) {
+				if (entry.isValid())
+					s3fs->release(entry.logref);
+				break;
+			}
+			this->latestSeqno = seqno;
+			appended++;
+		}
+		if (appended > 0)
+			this->indexAppended.notify_all();
+		fprintf(stdout, "added %lu entries to index %s\n", (unsigned long)appended, this->bucket_name.c_str());
+
+		// records of entries that were not appended are skipped by the dispatcher
+		for (S3NotificationOutbox *outbox : staged) {
+			notificationDispatcher->publish(*outbox);
+		}
+
+		std::vector<S3LogRef> released;
+		for (size_t i = 0; i < appended; ++i) {
+			const S3BucketIndexEntry& entry = entries[i];
+			auto replaced = this->liveEntries.find(entry.name);
+			if (replaced != this->liveEntries.end()) {
+				released.push_back(replaced->second.logref);
+				this->liveEntries.erase(replaced);
+			}
+			if (entry.isValid())
+				this->liveEntries[entry.name] = entry;
+		}
+		s3fs->release(released);
+
+		if (appended != entries.size()) {
 			throw AWSError(500, "Failed to append the entry to the index log");
 		}
 	}
 
-	void removeFromIndex(const char *key) {
-		// actually just appends a null S3LogRef associated with the key, this explicitly
-		// nulls the association
-		S3LogRef nullRef;
-		S3BucketIndexEntry entry(key, nullRef);
-		this->addToIndex(entry);
+	void addToIndex(const S3BucketIndexEntry& entry, const char *eventName = nullptr) {
+		this->addToIndex(std::vector<S3BucketIndexEntry>{entry}, eventName);
+	}
+
+	// appends a tombstone (an entry with a null S3LogRef, which explicitly nulls the association)
+	// for each of the keys that is currently live. Returns the keys that were removed.
+	std::vector<std::string> removeFromIndex(const std::vector<std::string>& keys, const char *eventName = nullptr) {
+		std::vector<S3BucketIndexEntry> tombstones;
+		std::vector<std::string> removed;
+		std::unordered_set<std::string> seen;
+		for (const auto& key : keys) {
+			if (this->liveEntries.find(key) == this->liveEntries.end() || !seen.insert(key).second)
+				continue;
+			tombstones.push_back(S3BucketIndexEntry(key.c_str(), S3LogRef()));
+			removed.push_back(key);
+		}
+		this->addToIndex(tombstones, eventName);
+		return removed;
 	}
 
 	S3BucketIndexEntry getEntryForKey(const char *key) {
-		S3BucketIndexEntry entry;
-		unsigned long seqno;
-		seqno = WooFGetLatestSeqno((char *)this->bucket_index_woof.c_str());
-
-		fprintf(stdout, "Scanning for entry associated with the key: %s starting at seqno: %lu\n", key, seqno);
-		while (!WooFInvalid(seqno) && WooFGet((char *)this->bucket_index_woof.c_str(), (void *)&entry, seqno) == 1) {
-			if (strncmp(entry.name, key, MAX_BUCKET_INDEX_ENTRIES) == 0) {
-				// then we found the match
-				return entry;
-			}
-			seqno--;
+		auto entry = this->liveEntries.find(key);
+		if (entry != this->liveEntries.end()) {
+			return entry->second;
 		}
 	
 		S3BucketIndexEntry nullEntry;
 		return nullEntry;
 	}
 
+	// reads the entry at exactly seqno, returns false if it is not (or no longer) in the log
+	bool getIndexEntry(unsigned long seqno, S3BucketIndexEntry &entry) {
+		return WooFGet((char *)this->bucket_index_woof.c_str(), (void *)&entry, seqno) == 1;
+	}
+
 	signed long getNextIndexEntry(long seqno, S3BucketIndexEntry &entry) {
 		if (seqno == -1) {
 			// you pass in seqno -1 to indicate the start of the traversal
@@ -152,7 +442,22 @@ public:
 		return -1;
 	}
 
+	// each subscription gets an outbox of its own so that records for the same lambda are 
+	// consecutive and can be batched, and a slow lambda does not hold up the others
+	S3NotificationOutbox &getOutbox(const std::string& lambdaArn) {
+		auto outbox = this->outboxes.find(lambdaArn);
+		if (outbox != this->outboxes.end())
+			return *(outbox->second);
+
+		char hash[65];
+		sha256((char *)lambdaArn.c_str(), lambdaArn.length(), hash);
+		std::string woofName = this->bucket_index_woof + "." + std::string(hash, 16) + ".outbox";
+		this->outboxes[lambdaArn] = notificationDispatcher->getOutbox(woofName);
+		return *(this->outboxes[lambdaArn]);
+	}
+
 	static S3Bucket &getOrCreateS3Bucket(const std::string& bucket_name) {
+		std::lock_guard<std::mutex> g(bucketsLock);
 		if (buckets.find(bucket_name) != buckets.end()) {
 			return *(buckets[bucket_name]);
 		}
@@ -219,8 +524,23 @@ public:
 	}
 };
 
+std::mutex S3Bucket::bucketsLock;
 std::unordered_map<std::string, std::unique_ptr<S3Bucket>> S3Bucket::buckets;
 
+// an outbox is named <index woof>.<arn hash>.outbox (see S3Bucket::getOutbox), base64 has no dots
+bool outboxRecordCommitted(const std::string& outboxName, const S3OutboxRecord& record) {
+	std::string indexWoof = outboxName.substr(0, outboxName.find('.'));
+	unsigned long latest = WooFGetLatestSeqno((char *)indexWoof.c_str());
+	if (WooFInvalid(latest) || latest < record.indexSeqno)
+		return false; // the append never happened
+
+	// an entry that has been overwritten in the bounded index log landed long ago
+	S3BucketIndexEntry entry;
+	if (WooFGet((char *)indexWoof.c_str(), (void *)&entry, record.indexSeqno) != 1)
+		return true;
+	return strncmp(entry.name, record.key, sizeof(record.key)) == 0;
+}
+
 std::mutex io_lock;
 
 class S3Key {
@@ -233,6 +553,13 @@ public:
 	S3Key(const char *path_ptr) {
 		if (path_ptr[0] == '/')
 			path_ptr++;
+
+		// the query string (if there is one) is not part of the path
+		const char *query = strchr(path_ptr, '?');
+		if (query != nullptr)
+			this->path = std::string(path_ptr, query - path_ptr);
+		else
+			this->path = path_ptr;
 		
 		std::size_t slashPos = this->path.find('/', 0);
 		
@@ -268,6 +595,11 @@ public:
 };
 
 
+// appends <name>value</name> to the parent node, the value is copied into the document
+inline void appendTextNode(xml_document<> &doc, xml_node<> *parent, const char *name, const char *value) {
+	parent->append_node(doc.allocate_node(node_element, name, doc.allocate_string(value)));
+}
+
 int callback_s3_put(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
 	fprintf(stdout, "\n\nPUT REQUEST: callback_s3_put\n");
 
@@ -275,8 +607,6 @@ int callback_s3_put(const struct _u_request * httprequest, struct _u_response *
 	S3Key key(httprequest->http_url);
 	S3Bucket &bucket = key.getS3Bucket();
 
-	std::lock_guard<std::mutex> g1(bucket.bucketLock);
-
 	if (!key.haveKey()) {
 		throw AWSError(500, "Object path not specified, only found bucket name");
 	}
@@ -296,6 +626,8 @@ int callback_s3_put(const struct _u_request * httprequest, struct _u_response *
 	}
 
 	fprintf(stdout, "writing payload to s3fs\n");
+	char etag[MD5_BASE16DIGEST_LENGTH];
+	md5(payload, payload_size, etag);
 	S3LogRef ref = s3fs->writeBuffer((void *)payload, payload_size);
 	
 	// fprintf(stdout, "writing s3logref record out to index log\n");
@@ -314,69 +646,198 @@ int callback_s3_put(const struct _u_request * httprequest, struct _u_response *
 	// 	}
 	// }
 
+	// the shards are not reachable until they are indexed, so only the index update (and the 
+	// notification that goes with it) needs to happen under the bucket lock
+	std::lock_guard<std::mutex> g1(bucket.bucketLock);
+
 	S3BucketIndexEntry entry(key.getKey().c_str(), ref);
-	entry.size = payload_size; // TODO: include additional metadata like last modified time
-	bucket.addToIndex(entry);
+	entry.size = payload_size;
+	entry.setETag(etag);
+	try {
+		bucket.addToIndex(entry, "s3:ObjectCreated:Put");
+	} catch (...) {
+		// e.g. SlowDown, nothing refers to the shards that were written
+		s3fs->discard(ref);
+		throw;
+	}
 
+	u_map_put(httpresponse->map_header, "ETag", entry.getQuotedETag().c_str());
 	ulfius_set_string_body_response(httpresponse, 200, "");
 
-	if (bucket.notifConfig != nullptr) {
-		fprintf(stdout, "Found bucket.notifConfig associated with the bucket, sending notification if anyone cares\n");
+	return U_CALLBACK_CONTINUE;
+}
 
-		// https://docs.aws.amazon.com/AmazonS3/latest/dev/notification-content-structure.html
-		json_t *event_full = json_object();
+// decodes the %XX escapes in a url encoded string
+std::string urlDecode(const char *str) {
+	std::string decoded;
+	for (; *str != '\0'; ++str) {
+		if (*str == '%' && isxdigit(str[1]) && isxdigit(str[2])) {
+			char hex[3] = {str[1], str[2], '\0'};
+			decoded.push_back((char)strtol(hex, NULL, 16));
+			str += 2;
+		} else if (*str == '+') {
+			decoded.push_back(' ');
+		} else {
+			decoded.push_back(*str);
+		}
+	}
+	return decoded;
+}
 
-		json_t *event_records = json_array();
-		json_object_set(event_full, "Records", event_records);
+int callback_s3_copy(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
+	fprintf(stdout, "\n\nPUT REQUEST: callback_s3_copy\n");
 
-		json_t *event = json_object();
-		json_array_append(event_records, event);
-		json_decref(event_records);
+	S3Key key(httprequest->http_url);
+	S3Bucket &bucket = key.getS3Bucket();
+	if (!key.haveKey()) {
+		throw AWSError(400, "InvalidRequest");
+	}
 
-		// have put the event object in the event array
-		json_object_set_new(event, "eventVersion", json_string("2.0"));
-		json_object_set_new(event, "eventSource", json_string("aws:s3"));
-		json_object_set_new(event, "awsRegion", json_string(FAKE_REGION));
-		json_object_set_new(event, "eventName", json_string("s3:ObjectCreated:Put"));
-		{
-			// https://stackoverflow.com/questions/9527960/how-do-i-construct-an-iso-8601-datetime-in-c
-			time_t now;
-			time(&now);
-			char buf[sizeof "2000-00-00T00:00:00Z"];
-			strftime(buf, sizeof buf, "%FT%TZ", gmtime(&now));
-			json_object_set_new(event, "eventTime", json_string(buf));
+	// x-amz-copy-source is the url encoded "bucket/key" of the object to copy
+	std::string source = urlDecode(u_map_get_case(httprequest->map_header, "x-amz-copy-source"));
+	S3Key sourceKey(source.c_str());
+	if (!sourceKey.haveKey()) {
+		throw AWSError(400, "InvalidArgument");
+	}
+
+	fprintf(stdout, "copying key %s in bucket %s to key %s in bucket %s\n", 
+		sourceKey.getKey().c_str(), sourceKey.getBucket().c_str(), key.getKey().c_str(), key.getBucket().c_str());
+
+	// the copy only writes a new index entry pointing at the source's shards. A reference is 
+	// held on them from the moment the source is looked up, so that deleting or overwriting
+	// the source before the copy is indexed can not release them.
+	S3BucketIndexEntry sourceEntry;
+	{
+		std::lock_guard<std::mutex> g(sourceKey.getS3Bucket().bucketLock);
+		sourceEntry = sourceKey.getS3Bucket().getEntryForKey(sourceKey.getKey().c_str());
+		if (!sourceEntry.isValid()) {
+			throw AWSError(404, "NoSuchKey");
 		}
+		s3fs->acquire(sourceEntry.logref);
+	}
 
-		json_t *event_s3 = json_object();
-		json_object_set(event, "s3", event_s3);
+	try {
+		std::lock_guard<std::mutex> g(bucket.bucketLock);
+		S3BucketIndexEntry entry(key.getKey().c_str(), sourceEntry.logref);
+		entry.size = sourceEntry.size;
+		entry.flags = sourceEntry.flags;
+		entry.setETag(sourceEntry.etag);
+		bucket.addToIndex(entry, "s3:ObjectCreated:Copy");
+	} catch (...) {
+		s3fs->release(sourceEntry.logref);
+		throw;
+	}
+	s3fs->release(sourceEntry.logref);
 
-		json_object_set_new(event_s3, "s3SchemaVersion", json_string("1.0"));
-		json_object_set_new(event_s3, "bucket", json_object());
-		
-		json_object_set_new(json_object_get(event_s3, "bucket"), "name", json_string(key.getBucket().c_str()));
-		json_object_set_new(json_object_get(event_s3, "bucket"), "arn", 
-			json_string(getArnForBucketName(key.getBucket().c_str()).c_str())
-		);
+	xml_document<> doc;
+	xml_node<> *node_result = doc.allocate_node(node_element, "CopyObjectResult");
+	doc.append_node(node_result);
+	if (sourceEntry.hasETag())
+		appendTextNode(doc, node_result, "ETag", sourceEntry.getQuotedETag().c_str());
+	{
+		time_t now;
+		time(&now);
+		char buf[sizeof "2000-00-00T00:00:00.000Z"];
+		strftime(buf, sizeof buf, "%FT%T.000Z", gmtime(&now));
+		appendTextNode(doc, node_result, "LastModified", buf);
+	}
 
-		json_object_set_new(event_s3, "object", json_object());
-		json_object_set_new(json_object_get(event_s3, "object"), "key", json_string(key.getKey().c_str()));
-		json_object_set_new(json_object_get(event_s3, "object"), "size", json_integer(payload_size));
+	std::string ss;
+	rapidxml::print(std::back_inserter(ss), doc, 0);
+	ulfius_set_string_body_response(httpresponse, 200, ss.c_str());
+	return U_CALLBACK_CONTINUE;
+}
 
-		json_decref(event_s3);
-		json_decref(event);
+// formats the time as an HTTP date, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+void formatHttpDate(time_t time, char buf[32]) {
+	struct tm tm;
+	gmtime_r(&time, &tm);
+	strftime(buf, 32, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
 
-		fprintf(stdout, "JSON EVENT NOTIFICATION: \n");
-		json_dumpf(event_full, stdout, JSON_INDENT(2));
-		fprintf(stdout, "\n");
+// entries migrated from a legacy index have neither, the headers are left out for them
+void setObjectMetadataHeaders(struct _u_response *httpresponse, S3BucketIndexEntry &entry) {
+	if (entry.hasETag())
+		u_map_put(httpresponse->map_header, "ETag", entry.getQuotedETag().c_str());
+	if (entry.lastModified != 0) {
+		char lastModified[32];
+		formatHttpDate(entry.lastModified, lastModified);
+		u_map_put(httpresponse->map_header, "Last-Modified", lastModified);
+	}
+}
 
-		// dispatch the notification
-		bucket.notifConfig->notify("s3:ObjectCreated:Put", event_full);
-		json_decref(event_full);
-		
-	} else {
-		fprintf(stdout, "bucket has no notifConfig, ending now silently. no one is interested\n");
+// evaluates If-None-Match and If-Modified-Since against the index entry alone. If-None-Match
+// takes precedence when both are given. An entry without an etag or modification time only
+// matches *, so it is always sent.
+bool isNotModified(const struct _u_request *httprequest, S3BucketIndexEntry &entry) {
+	const char *ifNoneMatch = u_map_get_case(httprequest->map_header, "If-None-Match");
+	if (ifNoneMatch != nullptr) {
+		// a comma separated list of (possibly weak) quoted etags, or *
+		std::string etags(ifNoneMatch);
+		std::size_t pos = 0;
+		while (pos < etags.length()) {
+			std::size_t end = etags.find(',', pos);
+			if (end == std::string::npos)
+				end = etags.length();
+			std::string etag = etags.substr(pos, end - pos);
+			etag.erase(0, etag.find_first_not_of(" \t"));
+			etag.erase(etag.find_last_not_of(" \t") + 1);
+			if (etag.compare(0, 2, "W/") == 0)
+				etag.erase(0, 2);
+			if (etag == "*" || (entry.hasETag() && (etag == entry.getQuotedETag() || etag == entry.etag)))
+				return true;
+			pos = end + 1;
+		}
+		return false;
 	}
 
+	const char *ifModifiedSince = u_map_get_case(httprequest->map_header, "If-Modified-Since");
+	if (ifModifiedSince != nullptr && entry.lastModified != 0) {
+		struct tm tm;
+		memset(&tm, 0, sizeof(tm));
+		if (strptime(ifModifiedSince, "%a, %d %b %Y %H:%M:%S GMT", &tm) != NULL) {
+			return entry.lastModified <= (int64_t)timegm(&tm);
+		}
+	}
+	return false;
+}
+
+static ssize_t head_stream_callback(void *stream_user_data, uint64_t offset, char *out_buf, size_t max) {
+	return U_STREAM_END;
+}
+
+int callback_s3_head(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
+	fprintf(stdout, "\n\nHEAD REQUEST: callback_s3_head\n");
+
+	S3Key key(httprequest->http_url);
+	S3Bucket &bucket = key.getS3Bucket();
+	if (!key.haveKey()) {
+		// buckets always exist, see callback_s3_put_notification
+		ulfius_set_string_body_response(httpresponse, 200, "");
+		return U_CALLBACK_CONTINUE;
+	}
+
+	S3BucketIndexEntry entry;
+	{
+		std::lock_guard<std::mutex> g(bucket.bucketLock);
+		entry = bucket.getEntryForKey(key.getKey().c_str());
+	}
+	if (!entry.isValid()) {
+		ulfius_set_string_body_response(httpresponse, 404, "");
+		return U_CALLBACK_CONTINUE;
+	}
+
+	// answered entirely from the index, the object's shards are never read
+	setObjectMetadataHeaders(httpresponse, entry);
+	if (isNotModified(httprequest, entry)) {
+		ulfius_set_string_body_response(httpresponse, 304, "");
+	} else {
+		// libmicrohttpd derives Content-Length from the response body and ignores (or duplicates)
+		// one set by hand, a stream response of the object's size reports it without a body, the
+		// callback is never called for HEAD
+		ulfius_set_stream_response(httpresponse, 200, head_stream_callback, NULL, entry.size, 
+			S3FileSystem::S3FILE_SHARD_BYTES, NULL);
+	}
 	return U_CALLBACK_CONTINUE;
 }
 
@@ -397,8 +858,16 @@ int callback_s3_get(const struct _u_request * httprequest, struct _u_response *
 		throw AWSError(404, "Not found");
 	}
 
+	setObjectMetadataHeaders(httpresponse, entry);
+	if (isNotModified(httprequest, entry)) {
+		fprintf(stdout, "object was not modified, not reading it\n");
+		ulfius_set_string_body_response(httpresponse, 304, "");
+		return U_CALLBACK_CONTINUE;
+	}
+
 	fprintf(stdout, "found record: %lx:%lu\n", entry.logref.logId, entry.logref.recordIdx);
-	std::string result = s3fs->readBuffer(entry.logref);
+	std::string result = entry.isManifest() ? 
+		s3fs->readManifest(entry.logref) : s3fs->readBuffer(entry.logref);
 
 	if (result.length() < 4096) {
 		fprintf(stdout, "The result from the WooF was: %s\n", result.c_str());
@@ -411,15 +880,345 @@ int callback_s3_get(const struct _u_request * httprequest, struct _u_response *
 	return U_CALLBACK_CONTINUE;
 }
 
+int callback_s3_create_multipart_upload(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
+	fprintf(stdout, "\n\nPOST REQUEST: callback_s3_create_multipart_upload\n");
+
+	S3Key key(httprequest->http_url);
+	if (!key.haveKey()) {
+		throw AWSError(400, "InvalidRequest");
+	}
+
+	std::shared_ptr<S3MultipartUpload> upload = multipartUploads.create(key.getBucket(), key.getKey());
+	fprintf(stdout, "started multipart upload %s for key %s in bucket %s\n", 
+		upload->uploadId.c_str(), key.getKey().c_str(), key.getBucket().c_str());
+
+	xml_document<> doc;
+	xml_node<> *node_result = doc.allocate_node(node_element, "InitiateMultipartUploadResult");
+	doc.append_node(node_result);
+	appendTextNode(doc, node_result, "Bucket", key.getBucket().c_str());
+	appendTextNode(doc, node_result, "Key", key.getKey().c_str());
+	appendTextNode(doc, node_result, "UploadId", upload->uploadId.c_str());
+
+	std::string ss;
+	rapidxml::print(std::back_inserter(ss), doc, 0);
+	ulfius_set_string_body_response(httpresponse, 200, ss.c_str());
+	return U_CALLBACK_CONTINUE;
+}
+
+int callback_s3_upload_part(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
+	fprintf(stdout, "\n\nPUT REQUEST: callback_s3_upload_part\n");
+
+	S3Key key(httprequest->http_url);
+	const char *partNumberStr = u_map_get(httprequest->map_url, "partNumber");
+	int partNumber = partNumberStr != nullptr ? atoi(partNumberStr) : 0;
+	if (partNumber < 1 || partNumber > MAX_MULTIPART_PART_NUMBER) {
+		throw AWSError(400, "InvalidArgument");
+	}
+
+	std::shared_ptr<S3MultipartUpload> upload = multipartUploads.get(
+		u_map_get(httprequest->map_url, "uploadId"), key.getBucket(), key.getKey());
+
+	// no bucket lock is held here, parts of the same upload are written to the shard logs in
+	// parallel with each other and with every other request on the bucket
+	S3MultipartUpload::Part part;
+	part.size = httprequest->binary_body_length;
+	{
+		char etag[MD5_BASE16DIGEST_LENGTH];
+		md5((const char *)httprequest->binary_body, part.size, etag);
+		part.etag = etag;
+	}
+	part.ref = s3fs->writeBuffer((void *)httprequest->binary_body, part.size);
+	S3MultipartUpload::Part replaced;
+	bool hadPart;
+	try {
+		hadPart = upload->putPart(partNumber, part, replaced);
+	} catch (...) {
+		// the upload was completed or aborted while the part was being written
+		s3fs->discard(part.ref);
+		throw;
+	}
+	if (hadPart) {
+		s3fs->discard(replaced.ref);
+	}
+
+	fprintf(stdout, "wrote part %d (%lu bytes) of upload %s\n", 
+		partNumber, (unsigned long)part.size, upload->uploadId.c_str());
+
+	u_map_put(httpresponse->map_header, "ETag", (std::string("\"") + part.etag + "\"").c_str());
+	ulfius_set_string_body_response(httpresponse, 200, "");
+	return U_CALLBACK_CONTINUE;
+}
+
+int callback_s3_complete_multipart_upload(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
+	fprintf(stdout, "\n\nPOST REQUEST: callback_s3_complete_multipart_upload\n");
+
+	S3Key key(httprequest->http_url);
+	S3Bucket &bucket = key.getS3Bucket();
+	std::shared_ptr<S3MultipartUpload> upload = multipartUploads.get(
+		u_map_get(httprequest->map_url, "uploadId"), key.getBucket(), key.getKey());
+
+	// the parts are taken out of the upload first, so that a concurrent abort or re-upload of
+	// a part cannot discard one of them before the manifest references it
+	std::map<int, S3MultipartUpload::Part> parts = upload->close();
+
+	// the parts listed in the request, in the order they make up the object
+	std::vector<S3FileSystem::S3ManifestPart> manifestParts;
+	uint64_t size = 0;
+	std::string partDigests; // the binary md5 of each part, concatenated
+	std::vector<int> listedPartNumbers;
+	try {
+		std::unique_ptr<char[]> data(new char[httprequest->binary_body_length + 1]);
+		memcpy((void *)data.get(), httprequest->binary_body, httprequest->binary_body_length);
+		data[httprequest->binary_body_length] = 0;
+
+		xml_document<> doc;
+		try {
+			doc.parse<0>(data.get());
+		} catch (const parse_error &e) {
+			fprintf(stderr, "Fatal error: bad XML in complete multipart upload request\n");
+			throw AWSError(400, "MalformedXML");
+		}
+
+		xml_node<> *node_complete = doc.first_node("CompleteMultipartUpload");
+		if (node_complete == nullptr) {
+			throw AWSError(400, "MalformedXML");
+		}
+
+		int lastPartNumber = 0;
+		for (xml_node<> *node_part = node_complete->first_node("Part");
+			node_part != nullptr;
+			node_part = node_part->next_sibling("Part")) {
+			xml_node<> *node_partNumber = node_part->first_node("PartNumber");
+			if (node_partNumber == nullptr) {
+				throw AWSError(400, "MalformedXML");
+			}
+
+			int partNumber = atoi(node_partNumber->value());
+			if (partNumber <= lastPartNumber) {
+				throw AWSError(400, "InvalidPartOrder");
+			}
+			lastPartNumber = partNumber;
+
+			auto listedPart = parts.find(partNumber);
+			if (listedPart == parts.end()) {
+				throw AWSError(400, "InvalidPart");
+			}
+			const S3MultipartUpload::Part& part = listedPart->second;
+			listedPartNumbers.push_back(partNumber);
+			xml_node<> *node_etag = node_part->first_node("ETag");
+			if (node_etag != nullptr && part.etag != node_etag->value() && 
+				std::string("\"") + part.etag + "\"" != node_etag->value()) {
+				throw AWSError(400, "InvalidPart");
+			}
+			for (size_t i = 0; i + 1 < part.etag.length(); i += 2) {
+				partDigests.push_back((char)strtol(part.etag.substr(i, 2).c_str(), NULL, 16));
+			}
+
+			S3FileSystem::S3ManifestPart manifestPart;
+			manifestPart.ref = part.ref;
+			manifestPart.size = part.size;
+			manifestParts.push_back(manifestPart);
+			size += part.size;
+		}
+
+		if (manifestParts.empty()) {
+			throw AWSError(400, "MalformedXML");
+		}
+	} catch (...) {
+		upload->reopen(parts);
+		throw;
+	}
+
+	// the outboxes are checked for room before the manifest takes the parts, so that an upload
+	// that is turned away with SlowDown can be completed again later. The bucket lock is held
+	// from the check to the index append, nothing else can fill them up in between.
+	std::unique_lock<std::mutex> bucketGuard(bucket.bucketLock);
+	try {
+		bucket.checkEventRoom({key.getKey()}, "s3:ObjectCreated:CompleteMultipartUpload");
+	} catch (...) {
+		upload->reopen(parts);
+		throw;
+	}
+
+	// stitch the parts together by reference, none of the part data is copied
+	S3LogRef ref = s3fs->writeManifest(manifestParts);
+
+	// like S3, the etag of a multipart object is the md5 of the part md5s and the part count
+	S3BucketIndexEntry entry(key.getKey().c_str(), ref);
+	entry.size = size;
+	entry.flags |= S3BucketIndexEntry::FLAG_MANIFEST;
+	{
+		char digest[MD5_BASE16DIGEST_LENGTH];
+		md5(partDigests.data(), partDigests.length(), digest);
+		entry.setETag((std::string(digest) + "-" + std::to_string(manifestParts.size())).c_str());
+	}
+
+	bucket.addToIndex(entry, "s3:ObjectCreated:CompleteMultipartUpload");
+	bucketGuard.unlock();
+	multipartUploads.remove(upload->uploadId);
+
+	// parts that were uploaded but left out of the object are not referenced by the manifest
+	for (int partNumber : listedPartNumbers) {
+		parts.erase(partNumber);
+	}
+	for (const auto& part : parts) {
+		s3fs->discard(part.second.ref);
+	}
+
+	fprintf(stdout, "completed multipart upload %s of %lu parts (%lu bytes)\n", 
+		upload->uploadId.c_str(), (unsigned long)manifestParts.size(), (unsigned long)size);
+
+	xml_document<> doc;
+	xml_node<> *node_result = doc.allocate_node(node_element, "CompleteMultipartUploadResult");
+	doc.append_node(node_result);
+	appendTextNode(doc, node_result, "Location", (std::string(S3_API_ENDPOINT "/") + key.getRawPath()).c_str());
+	appendTextNode(doc, node_result, "Bucket", key.getBucket().c_str());
+	appendTextNode(doc, node_result, "Key", key.getKey().c_str());
+	appendTextNode(doc, node_result, "ETag", entry.getQuotedETag().c_str());
+
+	std::string ss;
+	rapidxml::print(std::back_inserter(ss), doc, 0);
+	ulfius_set_string_body_response(httpresponse, 200, ss.c_str());
+	return U_CALLBACK_CONTINUE;
+}
+
+int callback_s3_abort_multipart_upload(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
+	fprintf(stdout, "\n\nDELETE REQUEST: callback_s3_abort_multipart_upload\n");
+
+	S3Key key(httprequest->http_url);
+	std::shared_ptr<S3MultipartUpload> upload = multipartUploads.get(
+		u_map_get(httprequest->map_url, "uploadId"), key.getBucket(), key.getKey());
+	std::map<int, S3MultipartUpload::Part> parts = upload->close();
+	multipartUploads.remove(upload->uploadId);
+	for (const auto& part : parts) {
+		s3fs->discard(part.second.ref);
+	}
+
+	fprintf(stdout, "aborted multipart upload %s\n", upload->uploadId.c_str());
+	ulfius_set_string_body_response(httpresponse, 204, "");
+	return U_CALLBACK_CONTINUE;
+}
+
+int callback_s3_delete(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
+	fprintf(stdout, "\n\nDELETE REQUEST: callback_s3_delete\n");
+
+	S3Key key(httprequest->http_url);
+	S3Bucket &bucket = key.getS3Bucket();
+	if (!key.haveKey()) {
+		throw AWSError(400, "InvalidRequest");
+	}
+
+	{
+		std::lock_guard<std::mutex> g(bucket.bucketLock);
+		bucket.removeFromIndex({key.getKey()}, "s3:ObjectRemoved:Delete");
+	}
+
+	// like S3, deleting a key that does not exist succeeds
+	ulfius_set_string_body_response(httpresponse, 204, "");
+	return U_CALLBACK_CONTINUE;
+}
+
+int callback_s3_delete_objects(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
+	fprintf(stdout, "\n\nPOST REQUEST: callback_s3_delete_objects\n");
+
+	S3Key key(httprequest->http_url);
+	S3Bucket &bucket = key.getS3Bucket();
+
+	std::vector<std::string> keys;
+	bool quiet = false;
+	{
+		std::unique_ptr<char[]> data(new char[httprequest->binary_body_length + 1]);
+		memcpy((void *)data.get(), httprequest->binary_body, httprequest->binary_body_length);
+		data[httprequest->binary_body_length] = 0;
+
+		xml_document<> doc;
+		try {
+			doc.parse<0>(data.get());
+		} catch (const parse_error &e) {
+			fprintf(stderr, "Fatal error: bad XML in delete objects request\n");
+			throw AWSError(400, "MalformedXML");
+		}
+
+		xml_node<> *node_delete = doc.first_node("Delete");
+		if (node_delete == nullptr) {
+			throw AWSError(400, "MalformedXML");
+		}
+
+		xml_node<> *node_quiet = node_delete->first_node("Quiet");
+		quiet = node_quiet != nullptr && strcmp(node_quiet->value(), "true") == 0;
+
+		for (xml_node<> *node_object = node_delete->first_node("Object");
+			node_object != nullptr;
+			node_object = node_object->next_sibling("Object")) {
+			xml_node<> *node_key = node_object->first_node("Key");
+			if (node_key == nullptr) {
+				throw AWSError(400, "MalformedXML");
+			}
+			keys.push_back(node_key->value());
+		}
+
+		if (keys.empty() || keys.size() > MAX_DELETE_OBJECTS_KEYS) {
+			throw AWSError(400, "MalformedXML");
+		}
+	}
+
+	// every tombstone for the request is appended under a single hold of the bucket lock, and
+	// the index view and reclaimer are updated once for the whole batch
+	{
+		std::lock_guard<std::mutex> g(bucket.bucketLock);
+		bucket.removeFromIndex(keys, "s3:ObjectRemoved:Delete");
+	}
+	fprintf(stdout, "deleted %lu keys from bucket %s\n", (unsigned long)keys.size(), key.getBucket().c_str());
+
+	xml_document<> doc;
+	xml_node<> *node_result = doc.allocate_node(node_element, "DeleteResult");
+	doc.append_node(node_result);
+	if (!quiet) {
+		for (const auto& deleted : keys) {
+			xml_node<> *node_deleted = doc.allocate_node(node_element, "Deleted");
+			node_result->append_node(node_deleted);
+			appendTextNode(doc, node_deleted, "Key", deleted.c_str());
+		}
+	}
+
+	std::string ss;
+	rapidxml::print(std::back_inserter(ss), doc, 0);
+	ulfius_set_string_body_response(httpresponse, 200, ss.c_str());
+	return U_CALLBACK_CONTINUE;
+}
+
+int callback_s3_post(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
+	if (u_map_has_key(httprequest->map_url, "delete")) {
+		return callback_s3_delete_objects(httprequest, httpresponse, user_data);
+	} else if (u_map_has_key(httprequest->map_url, "uploads")) {
+		return callback_s3_create_multipart_upload(httprequest, httpresponse, user_data);
+	} else if (u_map_has_key(httprequest->map_url, "uploadId")) {
+		return callback_s3_complete_multipart_upload(httprequest, httpresponse, user_data);
+	}
+	throw AWSError(400, "InvalidRequest");
+}
+
 int callback_s3_request(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
 	fprintf(stdout, "\n\nREQUEST TO S3 API URL: %s\n", httprequest->http_url);
 	ulfius_set_string_body_response(httpresponse, 200, "success\n");
 
 	try {
 		if (strcmp(httprequest->http_verb, "PUT") == 0) {
-		return callback_s3_put(httprequest, httpresponse, user_data);
+			if (u_map_has_key(httprequest->map_url, "uploadId"))
+				return callback_s3_upload_part(httprequest, httpresponse, user_data);
+			if (u_map_get_case(httprequest->map_header, "x-amz-copy-source") != nullptr)
+				return callback_s3_copy(httprequest, httpresponse, user_data);
+			return callback_s3_put(httprequest, httpresponse, user_data);
 		} else if (strcmp(httprequest->http_verb, "GET") == 0) {
 			return callback_s3_get(httprequest, httpresponse, user_data);
+		} else if (strcmp(httprequest->http_verb, "HEAD") == 0) {
+			return callback_s3_head(httprequest, httpresponse, user_data);
+		} else if (strcmp(httprequest->http_verb, "POST") == 0) {
+			return callback_s3_post(httprequest, httpresponse, user_data);
+		} else if (strcmp(httprequest->http_verb, "DELETE") == 0) {
+			if (u_map_has_key(httprequest->map_url, "uploadId"))
+				return callback_s3_abort_multipart_upload(httprequest, httpresponse, user_data);
+			return callback_s3_delete(httprequest, httpresponse, user_data);
 		}
 	} catch (const AWSError &e) {
 		fprintf(stderr, "Caught error: %s\n", e.msg.c_str());
@@ -432,7 +1231,94 @@ int callback_s3_request(const struct _u_request * httprequest, struct _u_respons
 	return U_CALLBACK_CONTINUE;
 }
 
+// returns the index entries appended after the seqno given by 'since', oldest first. The index log
+// is append only, so this is a feed of every put and delete on the bucket. With 'wait' the request
+// blocks for up to that many seconds until there is at least one change to return.
+int callback_s3_get_changes(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
+	fprintf(stdout, "\n\nREQUEST GET CHANGES: %s\n", httprequest->http_url);
+
+	try {
+		S3Key key(httprequest->http_url);
+		S3Bucket &bucket = key.getS3Bucket();
+
+		const char *sinceStr = u_map_get(httprequest->map_url, "since");
+		const char *maxEntriesStr = u_map_get(httprequest->map_url, "max-entries");
+		const char *waitStr = u_map_get(httprequest->map_url, "wait");
+		unsigned long since = sinceStr != nullptr ? strtoul(sinceStr, NULL, 10) : 0;
+		long maxEntries = maxEntriesStr != nullptr ? atol(maxEntriesStr) : MAX_CHANGE_FEED_ENTRIES;
+		long wait = waitStr != nullptr ? atol(waitStr) : 0;
+		if (maxEntries <= 0 || maxEntries > MAX_CHANGE_FEED_ENTRIES)
+			maxEntries = MAX_CHANGE_FEED_ENTRIES;
+		if (wait < 0)
+			wait = 0;
+		if (wait > MAX_CHANGE_FEED_WAIT_SECONDS)
+			wait = MAX_CHANGE_FEED_WAIT_SECONDS;
+
+		unsigned long latestSeqno;
+		{
+			std::unique_lock<std::mutex> g(bucket.bucketLock);
+			// a position the feed has not reached yet can only be a client error
+			if (since > bucket.latestSeqno) {
+				throw AWSError(400, "InvalidArgument");
+			}
+			bucket.indexAppended.wait_for(g, std::chrono::seconds(wait), [&bucket, since] {
+				return bucket.latestSeqno > since;
+			});
+			latestSeqno = bucket.latestSeqno;
+		}
+
+		// the entries themselves are read without the lock, appends never modify them
+		unsigned long lastSeqno = since;
+		xml_document<> doc;
+		xml_node<> *node_result = doc.allocate_node(node_element, "ChangeFeedResult");
+		doc.append_node(node_result);
+		appendTextNode(doc, node_result, "Bucket", key.getBucket().c_str());
+		// since <= latestSeqno, so the bound is computed without overflowing
+		unsigned long endSeqno = latestSeqno - since > (unsigned long)maxEntries ? since + maxEntries : latestSeqno;
+		for (unsigned long seqno = since + 1; seqno <= endSeqno; ++seqno) {
+			S3BucketIndexEntry entry;
+			if (!bucket.getIndexEntry(seqno, entry)) {
+				// the index log is a bounded WooF, entries this old have been overwritten and
+				// the client has to start over from a listing
+				fprintf(stderr, "Fatal error: change feed position %lu is no longer in the index log\n", seqno);
+				throw AWSError(410, "ChangeFeedExpired");
+			}
+			lastSeqno = seqno;
+
+			xml_node<> *node_change = doc.allocate_node(node_element, "Change");
+			node_result->append_node(node_change);
+			appendTextNode(doc, node_change, "Seqno", std::to_string(seqno).c_str());
+			appendTextNode(doc, node_change, "Type", entry.isValid() ? "Put" : "Delete");
+			appendTextNode(doc, node_change, "Key", entry.name);
+			if (entry.isValid()) {
+				appendTextNode(doc, node_change, "Size", std::to_string(entry.size).c_str());
+				if (entry.hasETag())
+					appendTextNode(doc, node_change, "ETag", entry.getQuotedETag().c_str());
+			}
+			if (entry.lastModified != 0) {
+				char lastModified[32];
+				formatHttpDate(entry.lastModified, lastModified);
+				appendTextNode(doc, node_change, "LastModified", lastModified);
+			}
+		}
+		appendTextNode(doc, node_result, "NextSince", std::to_string(lastSeqno).c_str());
+		appendTextNode(doc, node_result, "IsTruncated", lastSeqno < latestSeqno ? "true" : "false");
+
+		std::string ss;
+		rapidxml::print(std::back_inserter(ss), doc, 0);
+		ulfius_set_string_body_response(httpresponse, 200, ss.c_str());
+	} catch (const AWSError &e) {
+		fprintf(stderr, "Caught error: %s\n", e.msg.c_str());
+		ulfius_set_string_body_response(httpresponse, e.error_code, e.msg.c_str());
+	}
+	return U_CALLBACK_CONTINUE;
+}
+
 int callback_s3_get_objects(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
+	if (u_map_has_key(httprequest->map_url, "changes")) {
+		return callback_s3_get_changes(httprequest, httpresponse, user_data);
+	}
+
 	fprintf(stdout, "\n\nREQUEST GET LIST OBJECTS: %s\n", httprequest->http_url);
 
 	const char *end_of_bucket_name = strstr(httprequest->http_url, "?");
@@ -532,6 +1418,30 @@ int callback_s3_put_notification(const struct _u_request * httprequest, struct _
 	return U_CALLBACK_CONTINUE;
 }
 
+// reports how far behind event delivery is
+int callback_bridge_stats(const struct _u_request * httprequest, struct _u_response * httpresponse, void * user_data) {
+	NotificationDispatcher::Stats stats = notificationDispatcher->getStats();
+
+	json_t *notifications = json_object();
+	json_object_set_new(notifications, "Outboxes", json_integer(stats.outboxes));
+	json_object_set_new(notifications, "QueueDepth", json_integer(stats.queueDepth));
+	json_object_set_new(notifications, "Delivered", json_integer(stats.delivered));
+	json_object_set_new(notifications, "Invocations", json_integer(stats.invocations));
+	json_object_set_new(notifications, "Retries", json_integer(stats.retries));
+	json_object_set_new(notifications, "Dropped", json_integer(stats.dropped));
+	json_object_set_new(notifications, "Uncommitted", json_integer(stats.uncommitted));
+	json_object_set_new(notifications, "OldestPendingMs", json_integer(stats.oldestPendingMs));
+	json_object_set_new(notifications, "LastDeliveryLagMs", json_integer(stats.lastDeliveryLagMs));
+
+	json_t *body = json_object();
+	json_object_set_new(body, "Notifications", notifications);
+	char *body_str = json_dumps(body, 0);
+	json_decref(body);
+	ulfius_set_string_body_response(httpresponse, 200, body_str);
+	free(body_str);
+	return U_CALLBACK_CONTINUE;
+}
+
 void sig_handler(int sig) {
 	switch (sig) {
 	case SIGINT:
@@ -544,6 +1454,44 @@ void sig_handler(int sig) {
 	}
 }
 
+// the round trip through the probe handler (see lib/nsplatform.h), the bridge only puts without
+// handlers otherwise. A probe whose handler was never launched is lost, so another one is put
+// after a while and the result of any of them will do.
+struct NamespaceProbe {
+	unsigned long baseline = 0; // the latest seqno of the result woof before the first probe
+
+	// (re)creates the probe woofs, returns -1 on failure
+	int create() {
+		unlink(NSPLATFORM_PROBE_WOOF);
+		unlink(NSPLATFORM_PROBE_RESULT_WOOF);
+		if (WooFCreate((char *)NSPLATFORM_PROBE_WOOF, sizeof(uint64_t), NSPLATFORM_PROBE_QUEUE_DEPTH) != 1 ||
+			WooFCreate((char *)NSPLATFORM_PROBE_RESULT_WOOF, sizeof(uint64_t), NSPLATFORM_PROBE_QUEUE_DEPTH) != 1) {
+			fprintf(stderr, "failed to create the probe woofs\n");
+			return -1;
+		}
+		unsigned long seqno = WooFGetLatestSeqno((char *)NSPLATFORM_PROBE_RESULT_WOOF);
+		this->baseline = WooFInvalid(seqno) ? 0 : seqno;
+		return 0;
+	}
+};
+
+int probeNamespace(void *ctx) {
+	NamespaceProbe *probe = (NamespaceProbe *)ctx;
+	uint64_t token = (uint64_t)time(NULL);
+	if (WooFInvalid(WooFPut((char *)NSPLATFORM_PROBE_WOOF, (char *)NSPLATFORM_PROBE_HANDLER, (void *)&token)))
+		return -1;
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(NSPLATFORM_PROBE_ROUNDTRIP_MS);
+	do {
+		unsigned long seqno = WooFGetLatestSeqno((char *)NSPLATFORM_PROBE_RESULT_WOOF);
+		if (!WooFInvalid(seqno) && seqno > probe->baseline)
+			return 0;
+		struct timespec delay = { 0, NSPLATFORM_PROBE_MIN_MS * 1000000L };
+		nanosleep(&delay, NULL);
+	} while (std::chrono::steady_clock::now() < deadline);
+	return -1;
+}
+
 void run_tests();
 
 int main(int argc, char **argv) {
@@ -566,27 +1514,41 @@ int main(int argc, char **argv) {
 			exit(1);
 		}
 	}
+	// the handler of the readiness probe, missing from directories made before it existed
+	if (stat("./s3objects/" NSPLATFORM_PROBE_HANDLER, &st) == -1 && 
+		copy_file("./s3objects/" NSPLATFORM_PROBE_HANDLER, "./" NSPLATFORM_PROBE_HANDLER, 777) < 0) {
+		fprintf(stderr, "Fatal error: failed to copy the probe handler into the ./s3objects directory\n");
+		exit(1);
+	}
+
+	// Start the WooFCNamespacePlatform
+	fprintf(stdout, "starting woofcnamespace platform\n");
+	char *platform_argv[] = { (char *)"./woofc-namespace-platform", (char *)"-m", (char *)"1", (char *)"-M", (char *)"1", NULL };
+	pid_t woofcnamespaceplatform_pid = nsplatform_spawn("./s3objects", platform_argv);
+	if (woofcnamespaceplatform_pid < 0) {
+		fprintf(stderr, "Fatal error: failed to start the woofcnamespace platform\n");
+		return 1;
+	}
 
-	// Fork the WooFCNamespacePlatform
 	if (chdir("./s3objects") != 0) {
 		fprintf(stdout, "Fatal error: failed to change directory into the s3objects dir\n");
 		return 1;
 	}
 
-	fprintf(stdout, "forking woofcnamespace platform\n");
-	
-	int woofcnamespaceplatform_pid = fork();
-	if (woofcnamespaceplatform_pid == 0) {
-		fprintf(stdout, "Child process: successfully forked\n");
-		execl("./woofc-namespace-platform", "./woofc-namespace-platform", "-m", "1", "-M", "1", NULL);
-		fprintf(stdout, "Child process: FAILURE TO EXECL\n");
-		exit(1);
+	// WooFInit succeeds once the platform has initialized the namespace, and a probe comes back
+	// from its handler once the platform is serving it
+	auto init = [](void *) -> int { return WooFInit(); };
+	NamespaceProbe probe;
+	if (nsplatform_wait_ready(woofcnamespaceplatform_pid, init, NULL, NSPLATFORM_READY_TIMEOUT_MS) < 0 ||
+		probe.create() != 0 ||
+		nsplatform_wait_ready(woofcnamespaceplatform_pid, probeNamespace, &probe, NSPLATFORM_READY_TIMEOUT_MS) < 0) {
+		fprintf(stderr, "Fatal error: the woofcnamespace platform did not become ready\n");
+		kill(woofcnamespaceplatform_pid, SIGTERM);
+		return 1;
 	}
 
-	fprintf(stdout, "sleep 1 second then WooFInit\n");
-
-	sleep(1);
-	WooFInit();
+	// deliver whatever events were left in the outboxes when we last stopped
+	notificationDispatcher->resume();
 
 #ifdef RUN_TESTS
 	// a small test suite to run when RUN_TESTS is defined
@@ -604,6 +1566,7 @@ int main(int argc, char **argv) {
 	// b/c of some limitation we can't set the default endpoint without also adding a regular endpoint
 	ulfius_add_endpoint_by_val(&instance, "GET", "/", "/:bucket", 0, &callback_s3_get_objects, NULL);
 	ulfius_add_endpoint_by_val(&instance, "PUT", "/", "/:bucket", 0, &callback_s3_put_notification, NULL);
+	ulfius_add_endpoint_by_val(&instance, "GET", "/", "/_bridge/stats", 0, &callback_bridge_stats, NULL);
 	ulfius_set_default_endpoint(&instance, callback_s3_request, NULL);
 
 	// TODO: implement https://github.com/awslabs/lambda-refarch-mapreduce/blob/master/src/python/lambdautils.py#L88
@@ -659,7 +1622,144 @@ void run_s3_tests() {
 	exit(0);
 }
 
+void run_s3_head_tests() {
+	fprintf(stdout, "Testing that HEAD reports the size of an object\n");
+
+	S3Key key("/head-test-bucket/head-test-key");
+	S3BucketIndexEntry entry("head-test-key", s3fs->writeBuffer((void *)"0123456789", 10));
+	entry.size = 10;
+	entry.setETag("781e5e245d69b566979b86e28d23f2c7");
+	{
+		std::lock_guard<std::mutex> g(key.getS3Bucket().bucketLock);
+		key.getS3Bucket().addToIndex(entry);
+	}
+
+	struct _u_request request;
+	struct _u_response response;
+	ulfius_init_request(&request);
+	ulfius_init_response(&response);
+	request.http_verb = o_strdup("HEAD");
+	request.http_url = o_strdup("/head-test-bucket/head-test-key");
+	callback_s3_head(&request, &response, NULL);
+	fprintf(stdout, "status %ld, stream size %lu == 10\n", response.status, (unsigned long)response.stream_size);
+	assert(response.status == 200);
+	assert(response.stream_size == 10);
+	assert(u_map_get_case(response.map_header, "Content-Length") == NULL);
+	ulfius_clean_request(&request);
+	ulfius_clean_response(&response);
+}
+
+void run_s3_legacy_entry_tests() {
+	fprintf(stdout, "Testing entries migrated from a legacy index, without etag and modification time\n");
+
+	S3BucketIndexEntry entry("legacy-key", S3LogRef(0, 0));
+	entry.lastModified = 0;
+
+	struct _u_request request;
+	struct _u_response response;
+	ulfius_init_request(&request);
+	ulfius_init_response(&response);
+	setObjectMetadataHeaders(&response, entry);
+	assert(u_map_get_case(response.map_header, "ETag") == NULL);
+	assert(u_map_get_case(response.map_header, "Last-Modified") == NULL);
+
+	u_map_put(request.map_header, "If-None-Match", "\"\"");
+	assert(!isNotModified(&request, entry));
+	u_map_put(request.map_header, "If-None-Match", "*");
+	assert(isNotModified(&request, entry));
+	u_map_remove_from_key(request.map_header, "If-None-Match");
+	u_map_put(request.map_header, "If-Modified-Since", "Sun, 06 Nov 1994 08:49:37 GMT");
+	assert(!isNotModified(&request, entry));
+	ulfius_clean_request(&request);
+	ulfius_clean_response(&response);
+}
+
+void run_s3_manifest_tests() {
+	fprintf(stdout, "Testing objects assembled from a manifest of parts\n");
+
+	S3FileSystem fs;
+	std::string expected;
+	std::vector<S3FileSystem::S3ManifestPart> parts;
+	for (size_t size : {0, 10, 20000, 16 * 1024, 100000}) {
+		std::string part(size, (char)('a' + parts.size()));
+		S3FileSystem::S3ManifestPart manifestPart;
+		manifestPart.ref = fs.writeBuffer((void *)part.c_str(), part.length());
+		manifestPart.size = part.length();
+		parts.push_back(manifestPart);
+		expected += part;
+	}
+
+	S3LogRef ref = fs.writeManifest(parts);
+	assert(fs.readManifestParts(ref).size() == parts.size());
+	std::string output = fs.readManifest(ref);
+	fprintf(stdout, "length out %d == length written %d\n", (int)output.length(), (int)expected.length());
+	assert(output == expected);
+}
+
+void run_s3_notification_rule_tests() {
+	fprintf(stdout, "Testing the compiled notification rules\n");
+
+	assert(globMatch("s3:ObjectCreated:*", "s3:ObjectCreated:Put"));
+	assert(globMatch("s3:*:Delete", "s3:ObjectRemoved:Delete"));
+	assert(!globMatch("s3:ObjectCreated:*", "s3:ObjectRemoved:Delete"));
+	assert(eventTypeMask("s3:ObjectCreated:*") == eventTypeMask("s3:Object*") - eventTypeBit("s3:ObjectRemoved:Delete"));
+
+	const char *config = 
+		"<NotificationConfiguration>"
+		"<CloudFunctionConfiguration><CloudFunction>arn:aws:lambda:function:images</CloudFunction>"
+		"<Event>s3:ObjectCreated:*</Event><Filter><S3Key>"
+		"<FilterRule><Name>prefix</Name><Value>img/</Value></FilterRule>"
+		"<FilterRule><Name>suffix</Name><Value>.jpg</Value></FilterRule>"
+		"</S3Key></Filter></CloudFunctionConfiguration>"
+		"<CloudFunctionConfiguration><CloudFunction>arn:aws:lambda:function:text</CloudFunction>"
+		"<Event>s3:Object*</Event><Filter><S3Key>"
+		"<FilterRule><Name>suffix</Name><Value>.txt</Value></FilterRule>"
+		"</S3Key></Filter></CloudFunctionConfiguration>"
+		"</NotificationConfiguration>";
+	std::istringstream stream(config);
+	S3NotificationConfiguration notifConfig(stream);
+
+	assert(notifConfig.match("s3:ObjectCreated:Put", "img/cat.jpg").size() == 1);
+	assert(notifConfig.match("s3:ObjectCreated:Put", "img/cat.png").size() == 0);
+	assert(notifConfig.match("s3:ObjectCreated:Put", "img/.jpg").size() == 1);
+	assert(notifConfig.match("s3:ObjectCreated:Put", "doc/cat.jpg").size() == 0);
+	assert(notifConfig.match("s3:ObjectRemoved:Delete", "img/cat.jpg").size() == 0);
+	assert(notifConfig.match("s3:ObjectRemoved:Delete", "notes.txt").size() == 1);
+	assert(notifConfig.match("s3:ObjectCreated:Copy", "img/notes.txt")[0]->lambdaArn == "arn:aws:lambda:function:text");
+}
+
+void run_s3_event_template_tests() {
+	fprintf(stdout, "Testing the pre-rendered event records\n");
+
+	S3EventTemplate eventTemplate("my\"bucket");
+	char buffer[1024];
+	size_t length = eventTemplate.render(buffer, sizeof(buffer), "s3:ObjectCreated:Put", "dir/a\\b\n.txt", 59, 1537563524123LL);
+	std::string expected = "{\"eventVersion\":\"2.0\",\"eventSource\":\"aws:s3\",\"awsRegion\":\"" FAKE_REGION "\","
+		"\"eventName\":\"s3:ObjectCreated:Put\",\"eventTime\":\"2018-09-21T20:58:44.123Z\","
+		"\"s3\":{\"s3SchemaVersion\":\"1.0\",\"bucket\":{\"name\":\"my\\\"bucket\",\"arn\":\"arn:aws:s3:::my\\\"bucket\"},"
+		"\"object\":{\"key\":\"dir/a\\\\b\\n.txt\",\"size\":59}}}";
+	fprintf(stdout, "rendered %.*s\n", (int)length, buffer);
+	assert(std::string(buffer, length) == expected);
+
+	// the date math has to agree with gmtime, including leap days and the start of the epoch
+	for (int64_t seconds : {0LL, 951782400LL, 4107542399LL, 1709164800LL}) {
+		char timeBuffer[64];
+		JsonBufferWriter writer(timeBuffer, sizeof(timeBuffer));
+		writer.writeTime(seconds * 1000);
+		char expectedTime[64];
+		time_t t = seconds;
+		strftime(expectedTime, sizeof(expectedTime), "%Y-%m-%dT%H:%M:%S.000Z", gmtime(&t));
+		assert(std::string(timeBuffer, writer.length) == expectedTime);
+	}
+
+	assert(eventTemplate.render(buffer, 16, "s3:ObjectCreated:Put", "key", 0, 0) == 0);
+}
 
 void run_tests() {
+	run_s3_manifest_tests();
+	run_s3_head_tests();
+	run_s3_legacy_entry_tests();
+	run_s3_notification_rule_tests();
+	run_s3_event_template_tests();
 	run_s3_tests();
 }
\ No newline at end of file
@@ -2,12 +2,25 @@
 #define S3FILESYSTEM_HPP
 
 #include <random>
+#include <atomic>
+#include <map>
+#include <deque>
+#include <thread>
+#include <condition_variable>
 
 struct S3LogRef {
 	int64_t logId = -1;
 	int64_t recordIdx = -1; // index of the record in the log
 	S3LogRef() : logId(-1), recordIdx(-1) {};
 	S3LogRef(uint64_t logId, uint64_t recordIdx) : logId(logId), recordIdx(recordIdx) {};
+
+	bool operator==(const S3LogRef& other) const {
+		return logId == other.logId && recordIdx == other.recordIdx;
+	}
+
+	bool operator<(const S3LogRef& other) const {
+		return logId < other.logId || (logId == other.logId && recordIdx < other.recordIdx);
+	}
 };
 
 template<size_t record_size>
@@ -99,6 +112,8 @@ public:
 
 template<size_t record_size>
 class S3LogWriter {
+	// guards storageLog, which is replaced when the current log fills up
+	std::mutex lock;
 public:
 	uint64_t objectsPerLog;
 	std::unique_ptr<S3StorageLog<record_size>> storageLog = nullptr;
@@ -116,6 +131,7 @@ public:
 	}
 
 	S3LogRef append(void *data) {
+		std::lock_guard<std::mutex> guard(this->lock);
 		try {
 			return this->storageLog->append(data);
 		} catch (typename S3StorageLog<record_size>::OutOfSpaceException& e) {
@@ -134,6 +150,9 @@ struct S3FileSystem {
 	// each log holds 16 megabytes of data
 	constexpr static size_t S3FILE_SHARD_BYTES = 16 * 1024;
 	constexpr static size_t S3OBJECTS_PER_LOG = 1024;
+	// writes are striped across this many logs so that independent uploads (or the parts 
+	// of a multipart upload) do not serialize on a single log's lock
+	constexpr static size_t S3LOG_WRITER_STRIPES = PARALLELISM_SUPPORT;
 
 	struct FileExistsException : public std::exception { };
 	struct FileDoesNotExistException : public std::exception { };
@@ -144,28 +163,121 @@ struct S3FileSystem {
 		uint8_t data[S3FILE_SHARD_BYTES];
 	};
 
+	// a manifest is stored as a regular shard chain whose contents are a part count followed
+	// by that many S3ManifestPart records, objects assembled from parts are read through it
+	struct S3ManifestPart {
+		S3LogRef ref;
+		uint64_t size = 0;
+	};
+
 	std::unordered_map<std::string, S3LogRef> files;
-	S3LogWriter<sizeof(S3Shard)> theShardWriter = S3LogWriter<sizeof(S3Shard)>(S3OBJECTS_PER_LOG);
+	std::vector<std::unique_ptr<S3LogWriter<sizeof(S3Shard)>>> shardWriters;
+	std::atomic<uint64_t> nextWriter;
+
+	// every root (the head of a shard chain) written by this process. Each index entry pointing 
+	// at a root holds a reference, as does each manifest listing it as a part. Several index 
+	// entries can share a root (see CopyObject), so the shards behind a root may only be reclaimed
+	// once its count drops to zero. Roots written before the process started are not tracked and
+	// are never considered unreferenced.
+	struct S3RootInfo {
+		uint64_t refs = 0;
+		bool manifest = false;
+	};
+	std::mutex rootsLock;
+	std::map<S3LogRef, S3RootInfo> roots;
+
+	// how many shards of each log created by this process have been reclaimed. Once every
+	// record of a (necessarily full) log has been reclaimed the log is deleted.
+	std::mutex logUsageLock;
+	std::map<int64_t, uint64_t> reclaimedShards;
+
+	// roots that lost their last reference, walked and reclaimed by the reclaimer thread so that
+	// deletes do not pay for reading back the chains they free
+	std::mutex reclaimLock;
+	std::condition_variable reclaimReady;
+	std::deque<std::pair<S3LogRef, S3RootInfo>> reclaimQueue;
+	bool stopping = false;
+	std::thread reclaimer;
+
+	S3FileSystem() : nextWriter(0) {
+		for (size_t i = 0; i < S3LOG_WRITER_STRIPES; ++i) {
+			this->shardWriters.push_back(std::unique_ptr<S3LogWriter<sizeof(S3Shard)>>(
+				new S3LogWriter<sizeof(S3Shard)>(S3OBJECTS_PER_LOG)));
+		}
+		this->reclaimer = std::thread(&S3FileSystem::reclaimLoop, this);
+	}
+
+	~S3FileSystem() {
+		{
+			std::lock_guard<std::mutex> g(this->reclaimLock);
+			this->stopping = true;
+		}
+		this->reclaimReady.notify_all();
+		this->reclaimer.join();
+	}
 
 	S3LogRef writeBuffer(void *data, size_t data_len) {
-		// fprintf(stdout, "Writing ... data remaining ... %lu\n", data_len);
-		if (data_len > S3FILE_SHARD_BYTES) {
-			// fprintf(stdout, "\twrite large chunk and set nextShard to the appropriate ref\n");
-			auto nextShardRef = writeBuffer((void *)((uint8_t *)data + S3FILE_SHARD_BYTES), data_len - S3FILE_SHARD_BYTES);
-			// fprintf(stdout, "\t\twrote the chunk as ref %lx:%lu\n", nextShardRef.logId, nextShardRef.recordIdx);
+		return this->writeRoot(data, data_len, false);
+	}
 
-			std::unique_ptr<S3Shard> shard(new S3Shard);
-			shard->data_remaining = data_len;
-			memcpy(&(shard->data), data, S3FILE_SHARD_BYTES);
-			shard->nextShard = nextShardRef;
-			return this->theShardWriter.append((void *)shard.get());
-		} else {
-			// fprintf(stdout, "\twrite small and final chunk\n");
-			std::unique_ptr<S3Shard> shard(new S3Shard);
-			shard->data_remaining = data_len;
-			memcpy(&(shard->data), data, data_len);
-			return this->theShardWriter.append((void *)shard.get());
+	// returns false if the root is not tracked by this process
+	bool acquire(const S3LogRef& root) {
+		std::lock_guard<std::mutex> g(this->rootsLock);
+		auto info = this->roots.find(root);
+		if (info == this->roots.end()) 
+			return false;
+		info->second.refs++;
+		return true;
+	}
+
+	// drops a reference on each of the roots, the ones that become unreferenced are handed to 
+	// the reclaimer together
+	void release(const std::vector<S3LogRef>& releasedRoots) {
+		std::vector<std::pair<S3LogRef, S3RootInfo>> unreferenced;
+		{
+			std::lock_guard<std::mutex> g(this->rootsLock);
+			for (const auto& root : releasedRoots) {
+				auto info = this->roots.find(root);
+				if (info == this->roots.end() || info->second.refs == 0) 
+					continue;
+				if (--(info->second.refs) > 0)
+					continue;
+				unreferenced.push_back(*info);
+				this->roots.erase(info);
+			}
+		}
+		this->reclaim(unreferenced);
+	}
+
+	void release(const S3LogRef& root) {
+		this->release(std::vector<S3LogRef>{root});
+	}
+
+	// reclaims a root that was written but never referenced, e.g. the parts of an aborted upload
+	void discard(const S3LogRef& root) {
+		std::vector<std::pair<S3LogRef, S3RootInfo>> unreferenced;
+		{
+			std::lock_guard<std::mutex> g(this->rootsLock);
+			auto info = this->roots.find(root);
+			if (info == this->roots.end() || info->second.refs != 0)
+				return;
+			unreferenced.push_back(*info);
+			this->roots.erase(info);
 		}
+		this->reclaim(unreferenced);
+	}
+
+	S3LogRef writeManifest(const std::vector<S3ManifestPart>& parts) {
+		uint64_t partCount = parts.size();
+		std::string manifest(sizeof(partCount) + partCount * sizeof(S3ManifestPart), '\0');
+		memcpy(&manifest[0], &partCount, sizeof(partCount));
+		if (partCount > 0) {
+			memcpy(&manifest[sizeof(partCount)], parts.data(), partCount * sizeof(S3ManifestPart));
+		}
+		for (const auto& part : parts) {
+			this->acquire(part.ref);
+		}
+		return this->writeRoot((void *)manifest.data(), manifest.length(), true);
 	}
 
 	std::string readBuffer(S3LogRef ref) {
@@ -185,6 +297,133 @@ struct S3FileSystem {
 
 		return ss.str();
 	}
+
+	std::vector<S3ManifestPart> readManifestParts(S3LogRef ref) {
+		std::string manifest = this->readBuffer(ref);
+		uint64_t partCount = 0;
+		if (manifest.length() >= sizeof(partCount)) {
+			memcpy(&partCount, manifest.data(), sizeof(partCount));
+		}
+		if (manifest.length() < sizeof(partCount) || 
+			manifest.length() != sizeof(partCount) + partCount * sizeof(S3ManifestPart)) {
+			throw AWSError(500, "ServiceException").setDetails("object manifest was corrupted");
+		}
+
+		std::vector<S3ManifestPart> parts(partCount);
+		if (partCount > 0) {
+			memcpy(parts.data(), manifest.data() + sizeof(partCount), partCount * sizeof(S3ManifestPart));
+		}
+		return parts;
+	}
+
+	// reads back every part listed in the manifest, in order
+	std::string readManifest(S3LogRef ref) {
+		std::stringstream ss(std::stringstream::binary | std::stringstream::out);
+		for (const auto& part : this->readManifestParts(ref)) {
+			std::string data = this->readBuffer(part.ref);
+			ss.write(data.data(), data.length());
+		}
+		return ss.str();
+	}
+
+private:
+	S3LogRef writeRoot(void *data, size_t data_len, bool manifest) {
+		// the whole chain for the buffer goes to one stripe, concurrent writers pick different ones
+		auto& writer = *(this->shardWriters[this->nextWriter++ % S3LOG_WRITER_STRIPES]);
+		S3LogRef root = this->writeChain(writer, data, data_len);
+
+		// tracked but unreferenced until it is indexed or listed in a manifest
+		std::lock_guard<std::mutex> g(this->rootsLock);
+		S3RootInfo& info = this->roots[root];
+		info.refs = 0;
+		info.manifest = manifest;
+		return root;
+	}
+
+	void reclaim(const std::vector<std::pair<S3LogRef, S3RootInfo>>& unreferenced) {
+		if (unreferenced.empty())
+			return;
+		{
+			std::lock_guard<std::mutex> g(this->reclaimLock);
+			this->reclaimQueue.insert(this->reclaimQueue.end(), unreferenced.begin(), unreferenced.end());
+		}
+		this->reclaimReady.notify_one();
+	}
+
+	void reclaimLoop() {
+		while (true) {
+			std::pair<S3LogRef, S3RootInfo> root;
+			{
+				std::unique_lock<std::mutex> g(this->reclaimLock);
+				this->reclaimReady.wait(g, [this] { return this->stopping || !this->reclaimQueue.empty(); });
+				if (this->stopping)
+					return;
+				root = this->reclaimQueue.front();
+				this->reclaimQueue.pop_front();
+			}
+
+			try {
+				this->reclaimRoot(root.first, root.second);
+			} catch (const AWSError &e) {
+				fprintf(stderr, "failed to reclaim the chain at %lx:%lu: %s\n", 
+					root.first.logId, root.first.recordIdx, e.msg.c_str());
+			}
+		}
+	}
+
+	void reclaimRoot(S3LogRef ref, const S3RootInfo& info) {
+		// a manifest gives up its references on the parts it lists
+		if (info.manifest) {
+			std::vector<S3LogRef> parts;
+			for (const auto& part : this->readManifestParts(ref)) {
+				parts.push_back(part.ref);
+			}
+			this->release(parts);
+		}
+
+		std::unique_ptr<S3Shard> shard(new S3Shard);
+		while (ref.logId != -1) {
+			S3StorageLog<sizeof(S3Shard)>::get(ref, (void *)shard.get());
+
+			std::lock_guard<std::mutex> g(this->logUsageLock);
+			auto reclaimed = this->reclaimedShards.find(ref.logId);
+			if (reclaimed != this->reclaimedShards.end() && ++(reclaimed->second) == S3OBJECTS_PER_LOG) {
+				std::string logName = S3StorageLog<sizeof(S3Shard)>::getLogName(ref.logId);
+				fprintf(stdout, "every shard in log %s was reclaimed, removing it\n", logName.c_str());
+				unlink(logName.c_str());
+				this->reclaimedShards.erase(reclaimed);
+			}
+			ref = shard->nextShard;
+		}
+	}
+
+	S3LogRef appendShard(S3LogWriter<sizeof(S3Shard)>& writer, S3Shard *shard) {
+		S3LogRef ref = writer.append((void *)shard);
+		std::lock_guard<std::mutex> g(this->logUsageLock);
+		this->reclaimedShards.insert(std::make_pair(ref.logId, (uint64_t)0));
+		return ref;
+	}
+
+	S3LogRef writeChain(S3LogWriter<sizeof(S3Shard)>& writer, void *data, size_t data_len) {
+		// fprintf(stdout, "Writing ... data remaining ... %lu\n", data_len);
+		if (data_len > S3FILE_SHARD_BYTES) {
+			// fprintf(stdout, "\twrite large chunk and set nextShard to the appropriate ref\n");
+			auto nextShardRef = writeChain(writer, (void *)((uint8_t *)data + S3FILE_SHARD_BYTES), data_len - S3FILE_SHARD_BYTES);
+			// fprintf(stdout, "\t\twrote the chunk as ref %lx:%lu\n", nextShardRef.logId, nextShardRef.recordIdx);
+
+			std::unique_ptr<S3Shard> shard(new S3Shard);
+			shard->data_remaining = data_len;
+			memcpy(&(shard->data), data, S3FILE_SHARD_BYTES);
+			shard->nextShard = nextShardRef;
+			return this->appendShard(writer, shard.get());
+		} else {
+			// fprintf(stdout, "\twrite small and final chunk\n");
+			std::unique_ptr<S3Shard> shard(new S3Shard);
+			shard->data_remaining = data_len;
+			memcpy(&(shard->data), data, data_len);
+			return this->appendShard(writer, shard.get());
+		}
+	}
 };
 
 
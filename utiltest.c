@@ -6,6 +6,7 @@
 
 #include "lib/utility.h"
 #include "lib/wp.h"
+#include "lib/jsonscan.h"
 
 static void *work_thread(void *args) {
 	Queue *queue = (Queue *)args;
@@ -166,5 +167,36 @@ int main() {
 		free_wp(&wp);
 	}
 
+	{
+		fprintf(stdout, "\ttesting the validating json scanner\n");
+		const char *valid[] = {
+			"{}", "[]", " {\"a\": [1, -2.5e+3, true, false, null, \"x\\u00e9\\n\"]} ", "0",
+			"\"h\xc3\xa9\"", "[[[]],{}]", "-0.0E1", NULL
+		};
+		const char *invalid[] = {
+			"", "{", "{\"a\"}", "[1,]", "{\"a\":1,}", "01", "1.", "+1", "tru", "[1 2]", "{} {}",
+			"\"\x01\"", "\"\\x\"", "\"\xc0\xaf\"", "\"\xed\xa0\x80\"", "{1:2}", "[\"a\":1]", "\"abc", NULL
+		};
+
+		int i;
+		for (i = 0; valid[i] != NULL; ++i) {
+			if (jsonscan_validate(valid[i], strlen(valid[i])) != 0)
+				fprintf(stdout, "FAILED: rejected valid json '%s'\n", valid[i]);
+		}
+		for (i = 0; invalid[i] != NULL; ++i) {
+			if (jsonscan_validate(invalid[i], strlen(invalid[i])) == 0)
+				fprintf(stdout, "FAILED: accepted invalid json '%s'\n", invalid[i]);
+		}
+
+		char deep[2 * (JSONSCAN_MAX_DEPTH + 1)];
+		memset(deep, '[', JSONSCAN_MAX_DEPTH + 1);
+		memset(deep + JSONSCAN_MAX_DEPTH + 1, ']', JSONSCAN_MAX_DEPTH + 1);
+		if (jsonscan_validate(deep, sizeof(deep)) == 0)
+			fprintf(stdout, "FAILED: accepted json nested deeper than %d\n", JSONSCAN_MAX_DEPTH);
+		if (jsonscan_validate("{}\0", 3) == 0)
+			fprintf(stdout, "FAILED: accepted json with a nul byte\n");
+		fprintf(stdout, "Done.\n");
+	}
+
 	return 0;
 }
\ No newline at end of file